@@ -19,6 +19,10 @@
 /----------------------------------------------------------------------------*/
 
 
+#ifdef __linux__
+# define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -26,15 +30,32 @@
 #include <string.h>
 #include <locale.h>
 #include <stdarg.h>
+#include <errno.h>
 
 #ifndef WIN32
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <unistd.h>
+# include <sys/uio.h>
+# include <sys/mman.h>
 #else
 # error "TBD"
 #endif
 
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/fs.h>
+# if defined(__NR_io_uring_setup) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#   ifdef IORING_FEAT_RW_CUR_POS
+#    define HAVE_IO_URING 1
+#   endif
+#  endif
+# endif
+#endif
+
 #include "ff.h"
 #include "diskio.h"
 
@@ -89,7 +110,14 @@ void common_options(void)
   fprintf(stderr,
           "\t-h            :  show more help\n"
           "\t-f <filename> :  specify a device or image file (required).\n"
-          "\t-p <partno>   :  specify a partition number (1..4)\n" );
+          "\t-p <partno>   :  specify a partition number (1..4)\n"
+          "\t-m            :  access the image through a memory mapping\n"
+          "\t-u <depth>    :  use io_uring with up to <depth> pending requests\n"
+          "\t-c <nsect>    :  size of the sector cache (default 1024, 0 disables)\n"
+          "\t-v            :  report disk cache statistics\n"
+          "\t-B <size>     :  sector size of an image file (512..4096)\n"
+          "\t-D            :  bypass the page cache (O_DIRECT)\n"
+          "\t-M            :  keep the whole FAT in memory\n" );
 }
 
 int prompt(const char *fmt, ...)
@@ -145,7 +173,7 @@ int prompt(const char *fmt, ...)
 PARTITION VolToPart[FF_VOLUMES];
 #endif
 
-#if FF_USE_LFN == 3
+#if FF_USE_LFN == 3 || FF_FS_MEMFAT || FF_USE_FASTSEEK == 2 || FF_FS_LAZYFAT || FF_FS_DIRIDX || FF_FS_DCACHE
 void* ff_memalloc (UINT msize) { return malloc(msize); }
 void ff_memfree (void* mblock) { free(mblock); }
 #endif
@@ -160,6 +188,16 @@ const char *fn = 0;
 const char *sfn = 0;
 int fd = -1;
 int wp = 0;
+int mflag = 0;
+int qdepth = 0;
+int dflag = 0;
+int memfat = 0;
+int odirect = 0;
+int secsize = 0;
+int zflag = 0;
+off_t zsize = 0;
+BYTE *map = 0;
+size_t mapsz = 0;
 
 DSTATUS disk_status (BYTE pdrv)
 {
@@ -171,61 +209,977 @@ DSTATUS disk_status (BYTE pdrv)
   return 0;
 }
 
-DSTATUS disk_initialize (BYTE pdrv)
+void disk_map(void)
 {
-  if ((fd = open(fn, O_RDWR)) < 0) {
-    wp = 1;
-    if ((fd = open(fn, O_RDONLY)) < 0) {
-      fatal("Cannot open file \"%s\"\n", fn);
-      return STA_NOINIT;
-    }
+  off_t sz = lseek(fd, 0, SEEK_END);
+  int prot = (wp) ? PROT_READ : PROT_READ | PROT_WRITE;
+  void *p;
+
+  if (sz <= 0 || (off_t)(size_t)sz != sz) {
+    warning("Cannot map \"%s\", using regular I/O\n", fn);
+    return;
   }
-  return disk_status(pdrv);
+  p = mmap(NULL, (size_t)sz, prot, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    warning("Cannot map \"%s\", using regular I/O\n", fn);
+    return;
+  }
+  map = p;
+  mapsz = (size_t)sz;
 }
 
-DRESULT disk_read (BYTE pdrv, BYTE *buff, LBA_t sector,	UINT count)
+void *disk_alloc(size_t sz)
+{
+  void *p;
+
+  /* suitable for O_DIRECT transfers */
+  if (posix_memalign(&p, 4096, sz))
+    fatal("out of memory\n");
+  return p;
+}
+
+DRESULT disk_iov (int wr, struct iovec *v, int nv, off_t off)
 {
-  (void) pdrv;
-  size_t sz = (size_t)count * 512;
   ssize_t rsz;
 
-  if (! fd)
-    return RES_NOTRDY;
-  if (lseek(fd, (off_t)(sector * 512), SEEK_SET)  == (off_t)(-1))
-    return RES_PARERR;
-  while (sz > 0) {
-    rsz = read(fd, buff, sz);
+  while (nv > 0) {
+    if (wr)
+      rsz = pwritev(fd, v, nv, off);
+    else
+      rsz = preadv(fd, v, nv, off);
+    if (rsz < 0 && errno == EINTR)
+      continue;
+#ifdef O_DIRECT
+    if (rsz < 0 && errno == EINVAL && odirect) {
+      /* the medium wants a stricter alignment */
+      warning("Direct I/O is not possible on \"%s\", using regular I/O\n", fn);
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      odirect = 0;
+      continue;
+    }
+#endif
     if (rsz < 0)
       return RES_ERROR;
     if (rsz == 0)
       return RES_PARERR;
-    sz -= rsz;
-    buff += rsz;
+    off += rsz;
+    while (nv > 0 && (size_t)rsz >= v->iov_len) {
+      rsz -= v->iov_len;
+      v++;
+      nv--;
+    }
+    if (nv > 0) {
+      v->iov_base = (char*)v->iov_base + rsz;
+      v->iov_len -= rsz;
+    }
   }
   return RES_OK;
 }
 
-DRESULT disk_write (BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+#if HAVE_IO_URING
+
+/* Optional io_uring backend. Reads are split into pieces that are
+   queued together and awaited before returning. Writes are copied
+   into slot buffers and complete in the background until CTRL_SYNC
+   or until a transfer overlaps one of them. */
+
+#define URING_CHUNK (64*1024)
+#define URING_MINSPLIT (16*1024)
+#define URING_MAXDEPTH 256
+
+struct uring_slot {
+  int busy;                     /* 0:free, 1:write, 2:read */
+  BYTE *buf;                    /* write data or read destination */
+  BYTE *wbuf;                   /* private aligned buffer */
+  BYTE *dst;                    /* final destination of staged reads */
+  off_t off;
+  size_t len;
+};
+
+struct {
+  int fd;
+  unsigned nslots;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned sqtail;
+  unsigned queued;
+  unsigned nreads;
+  unsigned nwrites;
+  int rerr;
+  int werr;
+  struct uring_slot *slot;
+} ring = { .fd = -1 };
+
+void uring_setup(unsigned depth)
 {
-  (void) pdrv;
-  size_t sz = (size_t)count * 512;
-  ssize_t rsz;
+  struct io_uring_params p;
+  size_t sqsz, cqsz;
+  BYTE *sq, *cq;
+
+  if (depth > URING_MAXDEPTH)
+    depth = URING_MAXDEPTH;
+  memset(&p, 0, sizeof(p));
+  if ((ring.fd = syscall(__NR_io_uring_setup, depth, &p)) < 0) {
+    warning("io_uring is not available, using regular I/O\n");
+    return;
+  }
+  sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && cqsz > sqsz)
+    sqsz = cqsz;
+  sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_SQ_RING);
+  cq = sq;
+  if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+    cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ring.fd, IORING_OFF_CQ_RING);
+  ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring.fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    warning("Cannot map io_uring queues, using regular I/O\n");
+    if (ring.sqes != MAP_FAILED)
+      munmap(ring.sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+    if (cq != sq && cq != MAP_FAILED)
+      munmap(cq, cqsz);
+    if (sq != MAP_FAILED)
+      munmap(sq, sqsz);
+    ring.sqes = NULL;
+    close(ring.fd);
+    ring.fd = -1;
+    return;
+  }
+  ring.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+  ring.sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+  ring.sq_array = (unsigned*)(sq + p.sq_off.array);
+  ring.cq_head = (unsigned*)(cq + p.cq_off.head);
+  ring.cq_tail = (unsigned*)(cq + p.cq_off.tail);
+  ring.cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  ring.sqtail = *ring.sq_tail;
+  ring.nslots = p.sq_entries;
+  if (! (ring.slot = calloc(ring.nslots, sizeof(struct uring_slot))))
+    fatal("out of memory\n");
+}
+
+int uring_enter(unsigned nsubmit, unsigned nwait)
+{
+  int r;
+
+  do
+    r = syscall(__NR_io_uring_enter, ring.fd, nsubmit, nwait,
+                (nwait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  while (r < 0 && errno == EINTR);
+  return r;
+}
+
+void uring_submit(void)
+{
+  int r;
+
+  if (ring.queued == 0)
+    return;
+  __atomic_store_n(ring.sq_tail, ring.sqtail, __ATOMIC_RELEASE);
+  if ((r = uring_enter(ring.queued, 0)) < 0)
+    fatal("io_uring submission failed\n");
+  ring.queued -= r;
+}
+
+void uring_complete(struct uring_slot *s, int res)
+{
+  struct iovec iov;
+  int err = 0;
+
+  /* finish short or failed transfers with regular I/O */
+  if (res < 0)
+    res = 0;
+  if ((size_t)res < s->len) {
+    iov.iov_base = s->buf + res;
+    iov.iov_len = s->len - res;
+    err = disk_iov(s->busy == 1, &iov, 1, s->off + res) != RES_OK;
+  }
+  if (s->busy == 1) {
+    ring.werr |= err;
+    ring.nwrites -= 1;
+  } else {
+    if (s->dst)
+      memcpy(s->dst, s->buf, s->len);
+    ring.rerr |= err;
+    ring.nreads -= 1;
+  }
+  s->busy = 0;
+}
+
+void uring_reap(int wait)
+{
+  unsigned head = *ring.cq_head;
+  unsigned tail;
+
+  for(;;) {
+    tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    if (head != tail)
+      break;
+    if (! wait)
+      return;
+    uring_submit();
+    if (uring_enter(0, 1) < 0)
+      fatal("io_uring wait failed\n");
+  }
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+    uring_complete(&ring.slot[cqe->user_data], cqe->res);
+    head++;
+  }
+  __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+void uring_drain(void)
+{
+  uring_submit();
+  while (ring.nreads + ring.nwrites > 0)
+    uring_reap(1);
+}
+
+int uring_overlap(off_t off, size_t sz)
+{
+  unsigned i;
+
+  for (i = 0; i < ring.nslots; i++)
+    if (ring.slot[i].busy == 1 &&
+        ring.slot[i].off < off + (off_t)sz &&
+        off < ring.slot[i].off + (off_t)ring.slot[i].len)
+      return 1;
+  return 0;
+}
+
+unsigned uring_slot(void)
+{
+  unsigned i;
+
+  for(;;) {
+    for (i = 0; i < ring.nslots; i++)
+      if (! ring.slot[i].busy)
+        return i;
+    uring_reap(1);
+  }
+}
+
+void uring_queue(int wr, const struct iovec *iov, int niov, off_t off)
+{
+  size_t sz, n, m, piece, vo = 0;
+  struct io_uring_sqe *sqe;
+  struct uring_slot *s;
+  unsigned i;
+  int v;
+
+  for (sz = 0, v = 0; v < niov; v++)
+    sz += iov[v].iov_len;
+  if (uring_overlap(off, sz))
+    uring_drain();
+  /* spread large reads over the queue, gather writes in slot buffers */
+  piece = sz / ring.nslots;
+  piece = (piece < URING_MINSPLIT) ? URING_MINSPLIT : (piece + secsize - 1) & ~(size_t)(secsize - 1);
+  for (v = 0; sz > 0; ) {
+    s = &ring.slot[i = uring_slot()];
+    if (! s->wbuf)
+      s->wbuf = disk_alloc(URING_CHUNK);
+    s->dst = 0;
+    if (wr) {
+      for (n = 0; n < URING_CHUNK && n < sz; n += m) {
+        while (vo == iov[v].iov_len) {
+          v += 1;
+          vo = 0;
+        }
+        m = iov[v].iov_len - vo;
+        if (m > URING_CHUNK - n)
+          m = URING_CHUNK - n;
+        memcpy(s->wbuf + n, (BYTE*)iov[v].iov_base + vo, m);
+        vo += m;
+      }
+      s->buf = s->wbuf;
+      ring.nwrites += 1;
+    } else {
+      while (vo == iov[v].iov_len) {
+        v += 1;
+        vo = 0;
+      }
+      n = iov[v].iov_len - vo;
+      if (n > piece)
+        n = piece;
+      s->buf = (BYTE*)iov[v].iov_base + vo;
+      if (odirect && ((size_t)s->buf & (secsize - 1))) {
+        /* stage misaligned reads */
+        if (n > URING_CHUNK)
+          n = URING_CHUNK;
+        s->dst = s->buf;
+        s->buf = s->wbuf;
+      }
+      vo += n;
+      ring.nreads += 1;
+    }
+    s->busy = (wr) ? 1 : 2;
+    s->off = off;
+    s->len = n;
+    sqe = &ring.sqes[ring.sqtail & *ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (wr) ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = off;
+    sqe->addr = (unsigned long)s->buf;
+    sqe->len = n;
+    sqe->user_data = i;
+    ring.sq_array[ring.sqtail & *ring.sq_mask] = ring.sqtail & *ring.sq_mask;
+    ring.sqtail += 1;
+    ring.queued += 1;
+    off += n;
+    sz -= n;
+  }
+}
 
-  if (! fd)
+DRESULT uring_finish(int wr)
+{
+  uring_submit();
+  if (wr) {
+    uring_reap(0);
+    return RES_OK;
+  }
+  while (ring.nreads > 0)
+    uring_reap(1);
+  if (ring.rerr) {
+    ring.rerr = 0;
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+DRESULT uring_sync(void)
+{
+  uring_drain();
+  if (ring.werr) {
+    ring.werr = 0;
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+#endif
+int disk_sparse(const BYTE *buff, LBA_t sector, UINT count)
+{
+  size_t sz = (size_t)count * secsize;
+  off_t off = (off_t)sector * secsize;
+  off_t data;
+
+  /* only all-zero writes inside a regular file */
+  if (off + (off_t)sz > zsize || buff[0] || memcmp(buff, buff + 1, sz - 1))
+    return 0;
+#if HAVE_IO_URING
+  if (ring.fd >= 0 && uring_overlap(off, sz))
+    uring_drain();
+#endif
+#ifdef SEEK_DATA
+  data = lseek(fd, off, SEEK_DATA);
+  if ((data < 0 && errno == ENXIO) || data >= off + (off_t)sz)
+    return 1;
+#endif
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, sz) == 0)
+    return 1;
+#endif
+  return 0;
+}
+
+#define DISK_IOV_MAX 64
+#define BOUNCE_SIZE (64*1024)
+#define BOUNCE_COUNT 8
+
+BYTE *bounce[BOUNCE_COUNT];
+
+void bounce_copy (int wr, const struct iovec *iov, int *pv, size_t *pvo, size_t n)
+{
+  size_t m, c, vo = *pvo;
+  int v = *pv;
+  BYTE *bp;
+
+  for (m = 0; m < n; m += c) {
+    while (vo == iov[v].iov_len) {
+      v += 1;
+      vo = 0;
+    }
+    c = iov[v].iov_len - vo;
+    if (c > n - m)
+      c = n - m;
+    if (c > BOUNCE_SIZE - m % BOUNCE_SIZE)
+      c = BOUNCE_SIZE - m % BOUNCE_SIZE;
+    bp = bounce[m / BOUNCE_SIZE] + m % BOUNCE_SIZE;
+    if (wr)
+      memcpy(bp, (BYTE*)iov[v].iov_base + vo, c);
+    else
+      memcpy((BYTE*)iov[v].iov_base + vo, bp, c);
+    vo += c;
+  }
+  *pv = v;
+  *pvo = vo;
+}
+
+DRESULT disk_bounce (int wr, const struct iovec *iov, int niov, off_t off)
+{
+  struct iovec biov[BOUNCE_COUNT];
+  size_t sz, n, m, vo = 0;
+  int nb, v = 0;
+  DRESULT res;
+
+  /* stage misaligned direct transfers through the aligned pool */
+  for (sz = 0; v < niov; v++)
+    sz += iov[v].iov_len;
+  for (v = 0; sz > 0; sz -= n, off += n) {
+    n = (sz < BOUNCE_SIZE * BOUNCE_COUNT) ? sz : BOUNCE_SIZE * BOUNCE_COUNT;
+    for (nb = 0, m = 0; m < n; nb++, m += biov[nb-1].iov_len) {
+      if (! bounce[nb])
+        bounce[nb] = disk_alloc(BOUNCE_SIZE);
+      biov[nb].iov_base = bounce[nb];
+      biov[nb].iov_len = (n - m < BOUNCE_SIZE) ? n - m : BOUNCE_SIZE;
+    }
+    if (wr)
+      bounce_copy(1, iov, &v, &vo, n);
+    if ((res = disk_iov(wr, biov, nb, off)) != RES_OK)
+      return res;
+    if (! wr)
+      bounce_copy(0, iov, &v, &vo, n);
+  }
+  return RES_OK;
+}
+
+DRESULT disk_xferv (int wr, const DSEG *seg, UINT nseg)
+{
+  struct iovec iov[DISK_IOV_MAX];
+  UINT n;
+  int misaligned;
+  size_t sz;
+  off_t off;
+  DRESULT res;
+
+  if (fd < 0)
     return RES_NOTRDY;
+  if (wr && wp)
+    return RES_WRPRT;
+  while (nseg > 0) {
+    off = (off_t)seg->sector * secsize;
+    sz = (size_t)seg->count * secsize;
+    if (wr && zflag && disk_sparse(seg->buff, seg->sector, seg->count)) {
+      seg++;
+      nseg--;
+      continue;
+    }
+    if (map) {
+      if (off < 0 || (size_t)off > mapsz || sz > mapsz - (size_t)off)
+        return RES_PARERR;
+      if (wr)
+        memcpy(map + off, seg->buff, sz);
+      else
+        memcpy(seg->buff, map + off, sz);
+      seg++;
+      nseg--;
+      continue;
+    }
+    /* gather segments that are contiguous on the disk */
+    misaligned = 0;
+    for (n = 0; n < nseg && n < DISK_IOV_MAX; n++) {
+      if (n > 0 && (zflag || seg[n].sector != seg[n-1].sector + seg[n-1].count))
+        break;
+      iov[n].iov_base = seg[n].buff;
+      iov[n].iov_len = (size_t)seg[n].count * secsize;
+      misaligned |= (size_t)seg[n].buff & (secsize - 1);
+    }
+    seg += n;
+    nseg -= n;
+#if HAVE_IO_URING
+    if (ring.fd >= 0) {
+      uring_queue(wr, iov, n, off);
+      continue;
+    }
+#endif
+    /* transfer them with as few syscalls as possible */
+    if (odirect && misaligned)
+      res = disk_bounce(wr, iov, n, off);
+    else
+      res = disk_iov(wr, iov, n, off);
+    if (res != RES_OK)
+      return res;
+  }
+#if HAVE_IO_URING
+  if (ring.fd >= 0)
+    return uring_finish(wr);
+#endif
+  return RES_OK;
+}
+
+DRESULT disk_xfer (int wr, BYTE *buff, LBA_t sector, UINT count)
+{
+  DSEG seg;
+
+  seg.buff = buff;
+  seg.sector = sector;
+  seg.count = count;
+  return disk_xferv(wr, &seg, 1);
+}
+
+/* Sector cache. Small transfers go through a set associative
+   cache with LRU replacement within each set. Dirty sectors are
+   written back together, in ascending order and merged into runs of
+   adjacent sectors, when one of them must be evicted or when FatFs
+   issues CTRL_SYNC. Larger transfers bypass the cache but remain
+   coherent with it. */
+
+#define CACHE_WAYS 8
+#define CACHE_MAXXFER 8
+
+struct cache_line {
+  LBA_t sector;
+  unsigned stamp;
+  BYTE valid;
+  BYTE dirty;
+};
+
+int csize = 1024;
+int vflag = 0;
+
+struct {
+  unsigned nsets;
+  unsigned clock;
+  unsigned ndirty;
+  struct cache_line *line;
+  BYTE *data;
+  unsigned *order;
+  DSEG *seg;
+  unsigned long hits, misses, writebacks, runs;
+} cache;
+
+DRESULT cache_flush(void);
+
+void cache_setup(unsigned nsect)
+{
+  unsigned nlines;
+
+  cache.nsets = (nsect + CACHE_WAYS - 1) / CACHE_WAYS;
+  nlines = cache.nsets * CACHE_WAYS;
+  cache.line = calloc(nlines, sizeof(struct cache_line));
+  cache.data = disk_alloc((size_t)nlines * secsize);
+  cache.order = malloc(nlines * sizeof(unsigned));
+  cache.seg = malloc(nlines * sizeof(DSEG));
+  if (! cache.line || ! cache.data || ! cache.order || ! cache.seg)
+    fatal("out of memory\n");
+}
+
+int cache_find(LBA_t sector)
+{
+  unsigned k = (unsigned)(sector % cache.nsets) * CACHE_WAYS;
+  unsigned e = k + CACHE_WAYS;
+
+  for (; k < e; k++)
+    if (cache.line[k].valid && cache.line[k].sector == sector) {
+      cache.line[k].stamp = ++cache.clock;
+      return k;
+    }
+  return -1;
+}
+
+int cache_alloc(LBA_t sector)
+{
+  unsigned k = (unsigned)(sector % cache.nsets) * CACHE_WAYS;
+  unsigned e = k + CACHE_WAYS;
+  unsigned v = k;
+  struct cache_line *l;
+
+  for (; k < e; k++)
+    if (! cache.line[k].valid) {
+      v = k;
+      break;
+    } else if (cache.line[k].stamp < cache.line[v].stamp) {
+      v = k;
+    }
+  l = &cache.line[v];
+  if (l->valid && l->dirty && cache_flush() != RES_OK)
+    return -1;
+  l->sector = sector;
+  l->stamp = ++cache.clock;
+  l->valid = 1;
+  l->dirty = 0;
+  return v;
+}
+
+DRESULT cache_read(BYTE *buff, LBA_t sector, UINT count)
+{
+  DRESULT res;
+  UINT i, j, n;
+  int k;
+
+  if (count > CACHE_MAXXFER) {
+    if ((res = disk_xfer(0, buff, sector, count)) != RES_OK)
+      return res;
+    /* dirty sectors are more recent than the disk */
+    for (i = 0; i < count; i++)
+      if ((k = cache_find(sector + i)) >= 0 && cache.line[k].dirty)
+        memcpy(buff + (size_t)i * secsize, cache.data + (size_t)k * secsize, secsize);
+    return RES_OK;
+  }
+  for (i = 0; i < count; i += n) {
+    if ((k = cache_find(sector + i)) >= 0) {
+      memcpy(buff + (size_t)i * secsize, cache.data + (size_t)k * secsize, secsize);
+      cache.hits += 1;
+      n = 1;
+      continue;
+    }
+    /* read the run of missing sectors at once */
+    for (n = 1; i + n < count; n++)
+      if (cache_find(sector + i + n) >= 0)
+        break;
+    if ((res = disk_xfer(0, buff + (size_t)i * secsize, sector + i, n)) != RES_OK)
+      return res;
+    cache.misses += n;
+    for (j = i; j < i + n; j++) {
+      if ((k = cache_alloc(sector + j)) < 0)
+        return RES_ERROR;
+      memcpy(cache.data + (size_t)k * secsize, buff + (size_t)j * secsize, secsize);
+    }
+  }
+  return RES_OK;
+}
+
+DRESULT cache_write(const BYTE *buff, LBA_t sector, UINT count)
+{
+  DRESULT res;
+  UINT i;
+  int k;
+
   if (wp)
     return RES_WRPRT;
-  if (lseek(fd, (off_t)(sector * 512), SEEK_SET) == (off_t)(-1))
-    return RES_PARERR;
-  while (sz > 0) {
-    rsz = write(fd, buff, sz);
-    if (rsz < 0)
+  if (count > CACHE_MAXXFER) {
+    if ((res = disk_xfer(1, (BYTE*)buff, sector, count)) != RES_OK)
+      return res;
+    /* cached copies are now clean */
+    for (i = 0; i < count; i++)
+      if ((k = cache_find(sector + i)) >= 0) {
+        memcpy(cache.data + (size_t)k * secsize, buff + (size_t)i * secsize, secsize);
+        cache.ndirty -= cache.line[k].dirty;
+        cache.line[k].dirty = 0;
+      }
+    return RES_OK;
+  }
+  for (i = 0; i < count; i++) {
+    if ((k = cache_find(sector + i)) < 0 && (k = cache_alloc(sector + i)) < 0)
       return RES_ERROR;
-    if (rsz == 0)
-      return RES_PARERR;
-    sz -= rsz;
-    buff += rsz;
+    memcpy(cache.data + (size_t)k * secsize, buff + (size_t)i * secsize, secsize);
+    cache.ndirty += ! cache.line[k].dirty;
+    cache.line[k].dirty = 1;
+  }
+  return RES_OK;
+}
+
+int cache_cmp(const void *a, const void *b)
+{
+  LBA_t sa = cache.line[*(const unsigned*)a].sector;
+  LBA_t sb = cache.line[*(const unsigned*)b].sector;
+
+  return (sa < sb) ? -1 : (sa > sb) ? 1 : 0;
+}
+
+DRESULT cache_flush(void)
+{
+  unsigned k, n;
+
+  if (cache.ndirty == 0)
+    return RES_OK;
+  for (k = n = 0; k < cache.nsets * CACHE_WAYS; k++)
+    if (cache.line[k].valid && cache.line[k].dirty)
+      cache.order[n++] = k;
+  qsort(cache.order, n, sizeof(unsigned), cache_cmp);
+  for (k = 0; k < n; k++) {
+    cache.seg[k].buff = cache.data + (size_t)cache.order[k] * secsize;
+    cache.seg[k].sector = cache.line[cache.order[k]].sector;
+    cache.seg[k].count = 1;
+    if (k == 0 || cache.seg[k].sector != cache.seg[k-1].sector + 1)
+      cache.runs += 1;
+  }
+  if (disk_xferv(1, cache.seg, n) != RES_OK)
+    return RES_ERROR;
+  for (k = 0; k < n; k++)
+    cache.line[cache.order[k]].dirty = 0;
+  cache.ndirty = 0;
+  cache.writebacks += n;
+  return RES_OK;
+}
+
+void cache_discard(LBA_t sector, LBA_t count)
+{
+  unsigned k;
+  LBA_t i;
+  int j;
+
+  if (count > cache.nsets * CACHE_WAYS) {
+    for (k = 0; k < cache.nsets * CACHE_WAYS; k++)
+      if (cache.line[k].valid && cache.line[k].sector - sector < count) {
+        cache.ndirty -= cache.line[k].dirty;
+        cache.line[k].valid = cache.line[k].dirty = 0;
+      }
+  } else {
+    for (i = 0; i < count; i++)
+      if ((j = cache_find(sector + i)) >= 0) {
+        cache.ndirty -= cache.line[j].dirty;
+        cache.line[j].valid = cache.line[j].dirty = 0;
+      }
+  }
+}
+
+DRESULT disk_trim(LBA_t sector, LBA_t count)
+{
+  off_t off = (off_t)sector * secsize;
+  off_t len = (off_t)count * secsize;
+  struct stat st;
+
+  if (fd < 0)
+    return RES_NOTRDY;
+  if (wp)
+    return RES_WRPRT;
+  if (cache.line)
+    cache_discard(sector, count);
+#if HAVE_IO_URING
+  if (ring.fd >= 0 && uring_overlap(off, len))
+    uring_drain();
+#endif
+  if (fstat(fd, &st) < 0)
+    return RES_ERROR;
+#ifdef FALLOC_FL_PUNCH_HOLE
+  if (S_ISREG(st.st_mode))
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) < 0)
+      if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return RES_ERROR;
+#endif
+#ifdef BLKDISCARD
+  if (S_ISBLK(st.st_mode)) {
+    uint64_t range[2];
+    range[0] = off;
+    range[1] = len;
+    if (ioctl(fd, BLKDISCARD, range) < 0)
+      if (errno != EOPNOTSUPP && errno != ENOTTY)
+        return RES_ERROR;
   }
+#endif
+  return RES_OK;
+}
+
+/* Access pattern hints. Sequential multi-sector reads keep a
+   prefetch window ahead of them. In streaming mode, data that has
+   been transferred is dropped from the page cache behind us. */
+
+#define RA_WINDOW (512*1024)
+#define DROP_WINDOW (1024*1024)
+#define PREFETCH_MAX (16*1024*1024)
+
+int stream = 0;
+off_t ra_next = 0, ra_mark = 0;
+off_t drop_start = 0, drop_end = 0;
+
+void disk_prefetch(LBA_t sector, LBA_t count)
+{
+  off_t off = (off_t)sector * secsize;
+  off_t len = (off_t)count * secsize;
+
+  if (fd < 0 || map || odirect)
+    return;
+  if (len > PREFETCH_MAX)
+    len = PREFETCH_MAX;
+#ifdef __linux__
+  readahead(fd, off, len);
+#elif defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void disk_stream(void)
+{
+  stream = 1;
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (fd >= 0 && ! map && ! odirect)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void disk_hint(int wr, LBA_t sector, UINT count)
+{
+  off_t off = (off_t)sector * secsize;
+  off_t len = (off_t)count * secsize;
+
+  if (fd < 0 || map || odirect || count < 2)
+    return;
+#ifdef POSIX_FADV_WILLNEED
+  if (! wr && off == ra_next && off + len > ra_mark) {
+    posix_fadvise(fd, off + len, RA_WINDOW, POSIX_FADV_WILLNEED);
+    ra_mark = off + len + RA_WINDOW / 2;
+  }
+  if (! wr)
+    ra_next = off + len;
+#endif
+#ifdef POSIX_FADV_DONTNEED
+  /* cached writes do not reach the page cache yet */
+  if (stream && (! wr || ! cache.line || count > CACHE_MAXXFER)) {
+    if (off != drop_end) {
+      if (drop_end > drop_start)
+        posix_fadvise(fd, drop_start, drop_end - drop_start, POSIX_FADV_DONTNEED);
+      drop_start = off;
+    }
+    drop_end = off + len;
+    if (drop_end - drop_start >= DROP_WINDOW) {
+      posix_fadvise(fd, drop_start, drop_end - drop_start, POSIX_FADV_DONTNEED);
+      drop_start = drop_end;
+    }
+  }
+#endif
+}
+
+void disk_exit(void)
+{
+  static int once = 0;
+
+  if (once++)
+    return;
+  if (cache.line)
+    cache_flush();
+#if HAVE_IO_URING
+  if (ring.fd >= 0)
+    uring_drain();
+#endif
+  if (vflag && cache.line)
+    fprintf(stderr, "dosfs: cache: %lu hits, %lu misses, %lu sectors written back in %lu runs\n",
+            cache.hits, cache.misses, cache.writebacks, cache.runs);
+}
+
+int disk_secsize(void)
+{
+  struct stat st;
+  BYTE vbr[512];
+  int n;
+
+  if (fstat(fd, &st) < 0)
+    return 512;
+#ifdef BLKSSZGET
+  if (S_ISBLK(st.st_mode) &&
+      ioctl(fd, BLKSSZGET, &n) == 0 && n >= FF_MIN_SS && n <= FF_MAX_SS)
+    return n;
+#endif
+  /* images without partition table: trust the boot sector */
+  if (pread(fd, vbr, sizeof(vbr), 0) != sizeof(vbr) ||
+      vbr[510] != 0x55 || vbr[511] != 0xAA)
+    return 512;
+  if (! memcmp(vbr + 3, "EXFAT   ", 8))
+    n = (vbr[108] < 16) ? 1 << vbr[108] : 0;
+  else if (vbr[0] == 0xEB || vbr[0] == 0xE9)
+    n = vbr[11] | (vbr[12] << 8);
+  else
+    n = 0;
+  if (n >= FF_MIN_SS && n <= FF_MAX_SS && ! (n & (n - 1)))
+    return n;
+  return 512;
+}
+
+DSTATUS disk_initialize (BYTE pdrv)
+{
+  if (fd >= 0)
+    return disk_status(pdrv);
+  if ((fd = open(fn, O_RDWR)) < 0) {
+    wp = 1;
+    if ((fd = open(fn, O_RDONLY)) < 0) {
+      fatal("Cannot open file \"%s\"\n", fn);
+      return STA_NOINIT;
+    }
+  }
+  if (secsize == 0)
+    secsize = disk_secsize();
+  if (zflag) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+      zsize = st.st_size;
+    else
+      zflag = 0;
+  }
+  if (mflag)
+    disk_map();
+#ifdef O_DIRECT
+  if (dflag && ! map) {
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0)
+      odirect = 1;
+    else
+      warning("Direct I/O is not possible on \"%s\", using regular I/O\n", fn);
+  }
+#else
+  if (dflag)
+    warning("Direct I/O is not available, using regular I/O\n");
+#endif
+#if HAVE_IO_URING
+  if (qdepth > 0 && ! map)
+    uring_setup(qdepth);
+#else
+  if (qdepth > 0)
+    warning("io_uring support is not available, using regular I/O\n");
+#endif
+  if (csize > 0 && ! map)
+    cache_setup(csize);
+  atexit(disk_exit);
+  return disk_status(pdrv);
+}
+
+DRESULT disk_read (BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+  DRESULT res;
+
+  (void) pdrv;
+  if (cache.line)
+    res = cache_read(buff, sector, count);
+  else
+    res = disk_xfer(0, buff, sector, count);
+  if (res == RES_OK)
+    disk_hint(0, sector, count);
+  return res;
+}
+
+DRESULT disk_write (BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+{
+  DRESULT res;
+
+  (void) pdrv;
+  if (cache.line)
+    res = cache_write(buff, sector, count);
+  else
+    res = disk_xfer(1, (BYTE*)buff, sector, count);
+  if (res == RES_OK)
+    disk_hint(1, sector, count);
+  return res;
+}
+
+DRESULT disk_readv (BYTE pdrv, const DSEG *seg, UINT nseg)
+{
+  DRESULT res;
+
+  (void) pdrv;
+  if (! cache.line)
+    return disk_xferv(0, seg, nseg);
+  for (; nseg > 0; seg++, nseg--)
+    if ((res = cache_read(seg->buff, seg->sector, seg->count)) != RES_OK)
+      return res;
+  return RES_OK;
+}
+
+DRESULT disk_writev (BYTE pdrv, const DSEG *seg, UINT nseg)
+{
+  DRESULT res;
+
+  (void) pdrv;
+  if (! cache.line)
+    return disk_xferv(1, seg, nseg);
+  for (; nseg > 0; seg++, nseg--)
+    if ((res = cache_write(seg->buff, seg->sector, seg->count)) != RES_OK)
+      return res;
   return RES_OK;
 }
 
@@ -235,13 +1189,25 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void *buff)
   switch(cmd)
     {
     case CTRL_TRIM:
+      {
+        LBA_t *rt = buff;
+        return disk_trim(rt[0], rt[1] - rt[0] + 1);
+      }
     case CTRL_SYNC:
       {
+        if (cache.line && cache_flush() != RES_OK)
+          return RES_ERROR;
+        if (map && msync(map, mapsz, MS_ASYNC) < 0)
+          return RES_ERROR;
+#if HAVE_IO_URING
+        if (ring.fd >= 0)
+          return uring_sync();
+#endif
         return RES_OK;
       }
     case GET_SECTOR_SIZE:
       {
-        *(WORD*)buff = 512;
+        *(WORD*)buff = secsize;
         return RES_OK;
       }
     case GET_SECTOR_COUNT:
@@ -252,7 +1218,7 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void *buff)
         sz = lseek(fd, 0, SEEK_END);
         if (sz == (off_t)-1)
           return RES_ERROR;
-        *(LBA_t*)buff = (LBA_t)sz / 512;
+        *(LBA_t*)buff = (LBA_t)sz / secsize;
         return RES_OK;
       }
     default:
@@ -538,7 +1504,7 @@ FRESULT dosdir(int argc, const char **argv)
     printf("\n");
     f_getfree(path, &ncls, &vol);
     printf("    %8d File(s) %12lld bytes\n", nfiles, (long long)sfiles);
-    printf("    %8d Dir(s)  %12lld bytes free\n", ndirs, (long long)ncls * vol->csize * 512);
+    printf("    %8d Dir(s)  %12lld bytes free\n", ndirs, (long long)ncls * vol->csize * secsize);
   }
   return res;
 }
@@ -586,11 +1552,12 @@ FRESULT dosread(int argc, const char **argv)
       } else {
         FIL fil;
         char *path = fix_path(argv[i]);
-        char buffer[4096];
+        static char buffer[64*1024];
         UINT nread;
         res = f_open(&fil, path, FA_READ);
         if (res != FR_OK)
           return res;
+        disk_stream();
         do {
           res = f_read(&fil, buffer, (UINT)sizeof(buffer), &nread);
           if (res != FR_OK)
@@ -635,9 +1602,11 @@ FRESULT doswrite(int argc, const char **argv)
   BYTE mode = FA_WRITE | FA_CREATE_NEW;
   FRESULT res;
   FIL fil;
-  char buffer[4096];
+  static char buffer[64*1024];
   UINT nread, nwritten;
   int dflag = 0;
+  struct stat st;
+  FSIZE_t expect = 0;
 
   for (i=1; i<argc; i++) {
     if (! strcmp(argv[i],"-a"))
@@ -676,6 +1645,19 @@ FRESULT doswrite(int argc, const char **argv)
   res = f_open(&fil, path, mode);
   if (res != FR_OK)
     return res;
+  disk_stream();
+  /* Reserve a contiguous extent when the input size is known */
+  if (f_size(&fil) == 0 && fstat(fileno(stdin), &st) == 0
+      && S_ISREG(st.st_mode) && st.st_size > ftell(stdin)) {
+    expect = st.st_size - ftell(stdin);
+    res = f_expand(&fil, expect, 1);
+    if (res == FR_DENIED)   /* no contiguous extent: grow as we go */
+      expect = 0, res = FR_OK;
+    else if (res != FR_OK) {
+      f_close(&fil);
+      return res;
+    }
+  }
   for(;;) {
     nread = fread(buffer, 1, sizeof(buffer), stdin);
     if (nread == 0)
@@ -686,6 +1668,21 @@ FRESULT doswrite(int argc, const char **argv)
     if (nwritten < nread)
       break;
   }
+  if (expect && f_tell(&fil) < expect) {
+    /* drop the reserved tail that was not written, even after
+       a write error, so that it never shows stale data. The
+       file is reopened since a failed write leaves it unusable. */
+    FSIZE_t pos = f_tell(&fil);
+    FRESULT tres;
+    f_close(&fil);
+    tres = f_open(&fil, path, FA_WRITE);
+    if (tres == FR_OK)
+      tres = f_lseek(&fil, pos);
+    if (tres == FR_OK)
+      tres = f_truncate(&fil);
+    if (res == FR_OK)
+      res = tres;
+  }
   f_close(&fil);
   if (ferror(stdin))
     fatal("I/O error reading data from stdin\n");
@@ -1145,7 +2142,9 @@ FRESULT dosformat(int argc, const char **argv)
     if (! prompt("Erase everything in [%s]", sfn))
       return FR_OK;
   }
+  zflag = 1;
   res = f_mkfs("", &parm, buffer, sizeof(buffer));
+  zflag = 0;
   if (res != FR_OK)
     fatal_code(res);
   if ((res = f_mount(&vol, "", 1)) != FR_OK)
@@ -1258,6 +2257,51 @@ int main(int argc, const char **argv)
           help = 1;
           continue;
         }
+      if (! strcmp(argv[i], "-m"))
+        {
+          mflag = 1;
+          continue;
+        }
+      if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+          const char *p = argv[i + 1];
+          if ((csize = atoi(p)) < 0 || (csize == 0 && strcmp(p, "0")))
+            fatal("Not a valid cache size: %s\n", p);
+          i += 1;
+          continue;
+        }
+      if (!strcmp(argv[i], "-B") && i + 1 < argc)
+        {
+          const char *p = argv[i + 1];
+          secsize = atoi(p);
+          if (secsize < FF_MIN_SS || secsize > FF_MAX_SS || (secsize & (secsize - 1)))
+            fatal("Not a valid sector size: %s\n", p);
+          i += 1;
+          continue;
+        }
+      if (! strcmp(argv[i], "-D"))
+        {
+          dflag = 1;
+          continue;
+        }
+      if (! strcmp(argv[i], "-M"))
+        {
+          memfat = 1;
+          continue;
+        }
+      if (! strcmp(argv[i], "-v"))
+        {
+          vflag = 1;
+          continue;
+        }
+      if (!strcmp(argv[i], "-u") && i + 1 < argc)
+        {
+          const char *p = argv[i + 1];
+          if ((qdepth = atoi(p)) <= 0)
+            fatal("Not a valid queue depth: %s\n", p);
+          i += 1;
+          continue;
+        }
 #if FF_MULTI_PARTITION
       if (!strcmp(argv[i], "-p") && i + 1 < argc)
         {
@@ -1287,9 +2331,15 @@ int main(int argc, const char **argv)
     return EXIT_FAILURE;
   }
   /* Mount, run, unmount */
-  if (commands[cmdno].run != dosformat)
-    if ((res = f_mount(&vol, "", 1)) != FR_OK)
+  if (commands[cmdno].run != dosformat) {
+    if ((res = f_mount(&vol, "", memfat ? 3 : 1)) != FR_OK)
       fatal_code(res);
+    disk_prefetch(vol.fatbase, vol.fsize);
+#if FF_FS_EXFAT
+    if (vol.fs_type == FS_EXFAT)
+      disk_prefetch(vol.bitbase, (vol.n_fatent + 8 * secsize - 3) / (8 * secsize));
+#endif
+  }
   if ((res = commands[cmdno].run(nargc, nargv)) != FR_OK)
     fatal_code(res);
   if ((res = f_mount(NULL, "", 0)) != FR_OK && j >= 0)
@@ -22,6 +22,14 @@ typedef enum {
 } DRESULT;
 
 
+/* Segment of a vectored transfer (DSEG) */
+typedef struct {
+	BYTE*	buff;		/* Data buffer */
+	LBA_t	sector;		/* Start sector in LBA */
+	UINT	count;		/* Number of sectors */
+} DSEG;
+
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
@@ -31,6 +39,10 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+#if FF_USE_DISKV
+DRESULT disk_readv (BYTE pdrv, const DSEG* seg, UINT nseg);
+DRESULT disk_writev (BYTE pdrv, const DSEG* seg, UINT nseg);
+#endif
 
 
 /* Disk Status Bits (DSTATUS) */
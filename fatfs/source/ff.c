@@ -21,6 +21,12 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
+#if FF_USE_SIMD && !FF_FS_READONLY && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86	1
+#include <immintrin.h>	/* SSE2/AVX2 intrinsics */
+#else
+#define SIMD_X86	0
+#endif
 
 
 /*--------------------------------------------------------------------------
@@ -41,6 +47,10 @@
 #define MAX_FAT16	0xFFF5			/* Max FAT16 clusters (differs from specs, but right for real DOS/Windows behavior) */
 #define MAX_FAT32	0x0FFFFFF5		/* Max FAT32 clusters (not specified, practical limit) */
 #define MAX_EXFAT	0x7FFFFFFD		/* Max exFAT clusters (differs from specs, implementation limit) */
+#define MAX_MEMFAT	0x40000000		/* Max size of FAT to be loaded into memory */
+#define SZ_FATBUF	0x8000			/* Size of the in-memory FAT transfer buffer (must be >=FF_MAX_SS) */
+#define SZ_CNTBUF	0x4000			/* Size of the FAT read buffer of f_getfree() on the stack (must be >=FF_MAX_SS) */
+#define CLN_SHUT	0x08000000		/* FAT32: Clean shutdown flag in FAT[1] */
 
 
 /* Character code support macros */
@@ -1065,6 +1075,75 @@ static void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Deferred mirroring - Reflect the 1st FAT to the 2nd FAT at sync       */
+/*-----------------------------------------------------------------------*/
+
+static void init_fat2 (
+	FATFS* fs			/* Filesystem object */
+)
+{
+	BYTE *blk = 0;
+
+
+	if (fs->n_fats == 2) blk = ff_memalloc((UINT)(SZ_FATBUF + (fs->fsize + 7) / 8));
+	fs->fat2buf = blk;	/* Mirror the FAT immediately if not enough memory */
+	if (blk) {
+		fs->fat2dirty = blk + SZ_FATBUF;
+		mem_set(fs->fat2dirty, 0, (UINT)(fs->fsize + 7) / 8);
+		fs->fat2lo = fs->fsize; fs->fat2hi = 0;	/* No sector to be reflected */
+	}
+}
+
+
+static void free_fat2 (
+	FATFS* fs			/* Filesystem object */
+)
+{
+	if (fs->fat2buf) ff_memfree(fs->fat2buf);	/* Dirty flags are in the same block */
+	fs->fat2buf = 0;
+}
+
+
+static void mark_fat2 (
+	FATFS* fs,			/* Filesystem object */
+	DWORD sect			/* Sector offset in the FAT written into the 1st FAT */
+)
+{
+	fs->fat2dirty[sect / 8] |= 1 << sect % 8;
+	if (sect < fs->fat2lo) fs->fat2lo = sect;	/* Expand the range to be reflected */
+	if (sect >= fs->fat2hi) fs->fat2hi = sect + 1;
+}
+
+
+static FRESULT sync_fat2 (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	DWORD sect, i, n;
+
+
+	for (sect = fs->fat2lo; sect < fs->fat2hi; sect += n) {	/* Scan the range in ascending order */
+		for (n = 0; sect + n < fs->fat2hi && n < SZ_FATBUF / SS(fs) && (fs->fat2dirty[(sect + n) / 8] & 1 << (sect + n) % 8); n++) ;
+		if (n == 0) {	/* Skip a clean sector */
+			n = 1; continue;
+		}
+		if (disk_read(fs->pdrv, fs->fat2buf, fs->fatbase + sect, (UINT)n) != RES_OK	/* Copy a run of sectors from the 1st FAT */
+			|| disk_write(fs->pdrv, fs->fat2buf, fs->fatbase + fs->fsize + sect, (UINT)n) != RES_OK) {	/* into the 2nd FAT */
+			fs->fat2lo = sect;
+			return FR_DISK_ERR;
+		}
+		for (i = sect; i < sect + n; i++) fs->fat2dirty[i / 8] &= ~(1 << i % 8);
+	}
+	fs->fat2lo = fs->fsize; fs->fat2hi = 0;	/* No sector to be reflected */
+	return FR_OK;
+}
+#endif	/* FF_FS_LAZYFAT && !FF_FS_READONLY */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
@@ -1077,14 +1156,41 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty? */
+#if FF_USE_DISKV
+		DSEG seg[2];
+		UINT nseg = 1;
+
+		seg[0].buff = fs->win; seg[0].sector = fs->winsect; seg[0].count = 1;
+		if (fs->winsect - fs->fatbase < fs->fsize && fs->n_fats == 2) {	/* Is it in the 1st FAT? */
+#if FF_FS_LAZYFAT
+			if (fs->fat2buf) {
+				mark_fat2(fs, (DWORD)(fs->winsect - fs->fatbase));	/* Reflect it to 2nd FAT at sync */
+			} else
+#endif
+			{
+				seg[1] = seg[0]; seg[1].sector += fs->fsize; nseg = 2;	/* Reflect it to 2nd FAT in the same request */
+			}
+		}
+		if (disk_writev(fs->pdrv, seg, nseg) == RES_OK) {	/* Write it back into the volume */
+			fs->wflag = 0;	/* Clear window dirty flag */
+		} else {
+			res = FR_DISK_ERR;
+		}
+#else
 		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
 			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
+#if FF_FS_LAZYFAT
+				if (fs->fat2buf) {
+					mark_fat2(fs, (DWORD)(fs->winsect - fs->fatbase));	/* Reflect it to 2nd FAT at sync */
+				} else
+#endif
 				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
 			}
 		} else {
 			res = FR_DISK_ERR;
 		}
+#endif
 	}
 	return res;
 }
@@ -1117,6 +1223,229 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 
+#if FF_FS_MEMFAT
+/*-----------------------------------------------------------------------*/
+/* In-memory FAT - Load, flush and release the FAT held in memory        */
+/*-----------------------------------------------------------------------*/
+
+static void ld_memfat (
+	FATFS* fs,			/* Filesystem object */
+	const BYTE* buf,	/* FAT data to be decoded */
+	DWORD ofs,			/* Byte offset of the data in the FAT */
+	UINT len			/* Length of the data [byte] */
+)
+{
+	DWORD *fat = fs->fatmem;
+	UINT i;
+
+
+	switch (fs->fs_type) {
+	case FS_FAT12 :		/* 3 bytes hold 2 entries (the array must be cleared in advance) */
+		for (i = 0; i < len; i++, ofs++) {
+			switch (ofs % 3) {
+			case 0 : fat[ofs / 3 * 2] |= buf[i]; break;
+			case 1 : fat[ofs / 3 * 2] |= (DWORD)(buf[i] & 0x0F) << 8; fat[ofs / 3 * 2 + 1] |= buf[i] >> 4; break;
+			default : fat[ofs / 3 * 2 + 1] |= (DWORD)buf[i] << 4;
+			}
+		}
+		break;
+
+	case FS_FAT16 :		/* Simple WORD array */
+		for (i = 0; i < len; i += 2) fat[(ofs + i) / 2] = ld_word(buf + i);
+		break;
+
+	default :			/* FAT32/exFAT: Simple DWORD array with upper bits */
+		for (i = 0; i < len; i += 4) fat[(ofs + i) / 4] = ld_dword(buf + i);
+	}
+}
+
+
+#if !FF_FS_READONLY
+static void st_memfat (
+	FATFS* fs,			/* Filesystem object */
+	BYTE* buf,			/* Buffer to store the encoded FAT data */
+	DWORD ofs,			/* Byte offset of the data in the FAT */
+	UINT len			/* Length of the data [byte] */
+)
+{
+	DWORD *fat = fs->fatmem;
+	UINT i;
+
+
+	switch (fs->fs_type) {
+	case FS_FAT12 :
+		for (i = 0; i < len; i++, ofs++) {
+			switch (ofs % 3) {
+			case 0 : buf[i] = (BYTE)fat[ofs / 3 * 2]; break;
+			case 1 : buf[i] = (BYTE)((fat[ofs / 3 * 2] >> 8 & 0x0F) | fat[ofs / 3 * 2 + 1] << 4); break;
+			default : buf[i] = (BYTE)(fat[ofs / 3 * 2 + 1] >> 4);
+			}
+		}
+		break;
+
+	case FS_FAT16 :
+		for (i = 0; i < len; i += 2) st_word(buf + i, (WORD)fat[(ofs + i) / 2]);
+		break;
+
+	default :
+		for (i = 0; i < len; i += 4) st_dword(buf + i, fat[(ofs + i) / 4]);
+	}
+}
+
+
+static void mark_memfat (
+	FATFS* fs,			/* Filesystem object */
+	DWORD ofs			/* Byte offset in the FAT to be marked dirty */
+)
+{
+	DWORD sect = ofs / SS(fs);
+
+
+	fs->fatdirty[sect / 8] |= 1 << sect % 8;
+	if (sect < fs->fatdlo) fs->fatdlo = sect;		/* Expand the dirty range */
+	if (sect >= fs->fatdhi) fs->fatdhi = sect + 1;
+}
+
+
+static FRESULT sync_memfat (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	DWORD sect, i, n;
+#if FF_FS_LAZYFAT
+	UINT f;
+#elif FF_USE_DISKV
+	DSEG seg[2];
+#endif
+
+
+#if FF_FS_LAZYFAT
+	for (f = 0; f < fs->n_fats; f++) {	/* Write the 1st FAT, and then reflect it to the 2nd FAT in another pass */
+		for (sect = fs->fatdlo; sect < fs->fatdhi; sect += n) {	/* Scan the dirty range */
+			for (n = 0; sect + n < fs->fatdhi && n < SZ_FATBUF / SS(fs) && (fs->fatdirty[(sect + n) / 8] & 1 << (sect + n) % 8); n++) ;
+			if (n == 0) {	/* Skip a clean sector */
+				n = 1; continue;
+			}
+			st_memfat(fs, fs->fatbuf, sect * SS(fs), (UINT)n * SS(fs));	/* Encode a run of dirty sectors */
+			if (disk_write(fs->pdrv, fs->fatbuf, fs->fatbase + fs->fsize * f + sect, (UINT)n) != RES_OK) return FR_DISK_ERR;
+		}
+	}
+	for (i = fs->fatdlo; i < fs->fatdhi; i++) fs->fatdirty[i / 8] &= ~(1 << i % 8);
+#else
+	for (sect = fs->fatdlo; sect < fs->fatdhi; sect += n) {	/* Scan the dirty range */
+		for (n = 0; sect + n < fs->fatdhi && n < SZ_FATBUF / SS(fs) && (fs->fatdirty[(sect + n) / 8] & 1 << (sect + n) % 8); n++) ;
+		if (n == 0) {	/* Skip a clean sector */
+			n = 1; continue;
+		}
+		st_memfat(fs, fs->fatbuf, sect * SS(fs), (UINT)n * SS(fs));	/* Encode a run of dirty sectors */
+#if FF_USE_DISKV
+		seg[0].buff = seg[1].buff = fs->fatbuf;
+		seg[0].sector = fs->fatbase + sect; seg[1].sector = seg[0].sector + fs->fsize;
+		seg[0].count = seg[1].count = (UINT)n;
+		if (disk_writev(fs->pdrv, seg, fs->n_fats == 2 ? 2 : 1) != RES_OK) {	/* Write it into the 1st FAT and 2nd FAT in a request */
+			fs->fatdlo = sect;
+			return FR_DISK_ERR;
+		}
+#else
+		if (disk_write(fs->pdrv, fs->fatbuf, fs->fatbase + sect, (UINT)n) != RES_OK) {	/* Write it into the 1st FAT */
+			fs->fatdlo = sect;
+			return FR_DISK_ERR;
+		}
+		if (fs->n_fats == 2) disk_write(fs->pdrv, fs->fatbuf, fs->fatbase + fs->fsize + sect, (UINT)n);	/* Reflect it to 2nd FAT if needed */
+#endif
+		for (i = sect; i < sect + n; i++) fs->fatdirty[i / 8] &= ~(1 << i % 8);
+	}
+#endif
+	fs->fatdlo = fs->fsize; fs->fatdhi = 0;	/* No dirty sector */
+	return FR_OK;
+}
+#endif
+
+
+static void free_memfat (
+	FATFS* fs			/* Filesystem object */
+)
+{
+	if (fs->fatmem) ff_memfree(fs->fatmem);	/* Transfer buffer and dirty flags are in the same block */
+	fs->fatmem = 0;
+}
+
+
+static FRESULT load_memfat (	/* FR_OK(0):Loaded or not enough memory, !=0:Disk error */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	DWORD nent, sect, n, szb;
+	BYTE *blk;
+
+
+	fs->fatmem = 0;
+	if (fs->fsize >= MAX_MEMFAT / SS(fs)) return FR_OK;	/* Leave a huge FAT on the volume */
+	szb = fs->fsize * SS(fs);		/* Size of the FAT [byte] */
+	switch (fs->fs_type) {			/* Number of entries fit in the FAT */
+	case FS_FAT12 :	nent = (szb + 2) / 3 * 2; break;
+	case FS_FAT16 :	nent = szb / 2; break;
+	default :		nent = szb / 4;
+	}
+	blk = ff_memalloc((UINT)(nent * 4 + SZ_FATBUF + (fs->fsize + 7) / 8));
+	if (!blk) return FR_OK;			/* Access the FAT on the volume if not enough memory */
+	fs->fatmem = (DWORD*)blk;
+	fs->fatbuf = blk + nent * 4;
+#if !FF_FS_READONLY
+	fs->fatdirty = fs->fatbuf + SZ_FATBUF;
+	mem_set(fs->fatdirty, 0, (UINT)(fs->fsize + 7) / 8);
+	fs->fatdlo = fs->fsize; fs->fatdhi = 0;	/* No dirty sector */
+#endif
+	if (fs->fs_type == FS_FAT12) mem_set(fs->fatmem, 0, (UINT)nent * 4);
+	for (sect = 0; sect < fs->fsize; sect += n) {	/* Load the 1st FAT in blocks */
+		n = fs->fsize - sect;
+		if (n > SZ_FATBUF / SS(fs)) n = SZ_FATBUF / SS(fs);
+		if (disk_read(fs->pdrv, fs->fatbuf, fs->fatbase + sect, (UINT)n) != RES_OK) {
+			free_memfat(fs);
+			return FR_DISK_ERR;
+		}
+		ld_memfat(fs, fs->fatbuf, sect * SS(fs), (UINT)n * SS(fs));
+	}
+	return FR_OK;
+}
+#endif	/* FF_FS_MEMFAT */
+
+
+
+
+#if FF_FS_TRUSTFSINFO && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT32: Set or clear the clean shutdown flag in FAT[1]                 */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT set_clnshut (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* Corresponding filesystem object (FAT32) */
+	int cln			/* 1:Mark the volume clean, 0:Mark the volume dirty */
+)
+{
+	DWORD val;
+	FRESULT res;
+
+
+#if FF_FS_MEMFAT
+	if (fs->fatmem) {	/* Update the in-memory FAT and mark the sector dirty */
+		fs->fatmem[1] = cln ? fs->fatmem[1] | CLN_SHUT : fs->fatmem[1] & ~CLN_SHUT;
+		mark_memfat(fs, 4);
+		return FR_OK;
+	}
+#endif
+	res = move_window(fs, fs->fatbase);
+	if (res == FR_OK) {
+		val = ld_dword(fs->win + 4);
+		st_dword(fs->win + 4, cln ? val | CLN_SHUT : val & ~CLN_SHUT);
+		fs->wflag = 1;
+	}
+	return res;
+}
+#endif
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Synchronize filesystem and data on the storage                        */
@@ -1130,8 +1459,14 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	res = sync_window(fs);
+#if FF_FS_MEMFAT
+	if (res == FR_OK && fs->fatmem) res = sync_memfat(fs);	/* Flush the in-memory FAT */
+#endif
+#if FF_FS_LAZYFAT
+	if (res == FR_OK && fs->fat2buf) res = sync_fat2(fs);	/* Reflect the 1st FAT to the 2nd FAT */
+#endif
 	if (res == FR_OK) {
-		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {	/* FAT32: Update FSInfo sector if needed */
+		if (fs->fs_type == FS_FAT32 && (fs->fsi_flag & 0x81) == 1) {	/* FAT32: Update FSInfo sector if needed */
 			/* Create FSInfo structure */
 			mem_set(fs->win, 0, sizeof fs->win);
 			st_word(fs->win + BS_55AA, 0xAA55);					/* Boot signature */
@@ -1141,8 +1476,21 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 			st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);	/* Last allocated culuster */
 			fs->winsect = fs->volbase + 1;						/* Write it into the FSInfo sector (Next to VBR) */
 			disk_write(fs->pdrv, fs->win, fs->winsect, 1);
-			fs->fsi_flag = 0;
+			fs->fsi_flag &= ~1;
+		}
+#if FF_FS_TRUSTFSINFO
+		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 2) {	/* FAT32: Mark the volume clean when the FSInfo is up to date */
+			res = set_clnshut(fs, 1);
+			if (res == FR_OK) res = sync_window(fs);
+#if FF_FS_MEMFAT
+			if (res == FR_OK && fs->fatmem) res = sync_memfat(fs);
+#endif
+#if FF_FS_LAZYFAT
+			if (res == FR_OK && fs->fat2buf) res = sync_fat2(fs);
+#endif
+			if (res == FR_OK) fs->fsi_flag = 0;
 		}
+#endif
 		/* Make sure that no pending write process in the lower layer */
 		if (disk_ioctl(fs->pdrv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
 	}
@@ -1193,6 +1541,12 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 
 		switch (fs->fs_type) {
 		case FS_FAT12 :
+#if FF_FS_MEMFAT
+			if (fs->fatmem) {
+				val = fs->fatmem[clst];
+				break;
+			}
+#endif
 			bc = (UINT)clst; bc += bc / 2;
 			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
 			wc = fs->win[bc++ % SS(fs)];		/* Get 1st byte of the entry */
@@ -1202,11 +1556,23 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 			break;
 
 		case FS_FAT16 :
+#if FF_FS_MEMFAT
+			if (fs->fatmem) {
+				val = fs->fatmem[clst];
+				break;
+			}
+#endif
 			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2))) != FR_OK) break;
 			val = ld_word(fs->win + clst * 2 % SS(fs));		/* Simple WORD array */
 			break;
 
 		case FS_FAT32 :
+#if FF_FS_MEMFAT
+			if (fs->fatmem) {
+				val = fs->fatmem[clst] & 0x0FFFFFFF;
+				break;
+			}
+#endif
 			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
 			val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x0FFFFFFF;	/* Simple DWORD array but mask out upper 4 bits */
 			break;
@@ -1227,6 +1593,10 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 				if (obj->stat != 2) {	/* Get value from FAT if FAT chain is valid */
 					if (obj->n_frag != 0) {	/* Is it on the growing edge? */
 						val = 0x7FFFFFFF;	/* Generate EOC */
+#if FF_FS_MEMFAT
+					} else if (fs->fatmem) {
+						val = fs->fatmem[clst] & 0x7FFFFFFF;
+#endif
 					} else {
 						if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
 						val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x7FFFFFFF;
@@ -1265,6 +1635,40 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if FF_FS_TRUSTFSINFO
+		if (fs->fs_type == FS_FAT32 && !(fs->fsi_flag & 0xC2)) {	/* First change to the FAT after mount or sync? */
+			fs->fsi_flag |= 2;
+			res = set_clnshut(fs, 0);	/* Mark the volume dirty until the FSInfo is brought up to date */
+			if (res != FR_OK) return res;
+		}
+#endif
+#if FF_FS_MEMFAT
+		if (fs->fatmem) {	/* Update the in-memory FAT and mark the sector dirty */
+			switch (fs->fs_type) {
+			case FS_FAT12:
+				fs->fatmem[clst] = val & 0xFFF;
+				bc = (UINT)clst; bc += bc / 2;
+				mark_memfat(fs, bc); mark_memfat(fs, bc + 1);	/* The entry can straddle sector boundary */
+				return FR_OK;
+
+			case FS_FAT16:
+				fs->fatmem[clst] = val & 0xFFFF;
+				mark_memfat(fs, clst * 2);
+				return FR_OK;
+
+			case FS_FAT32:
+#if FF_FS_EXFAT
+			case FS_EXFAT:
+#endif
+				if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
+					val = (val & 0x0FFFFFFF) | (fs->fatmem[clst] & 0xF0000000);
+				}
+				fs->fatmem[clst] = val;
+				mark_memfat(fs, clst * 4);
+				return FR_OK;
+			}
+		}
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12:
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
@@ -1304,6 +1708,57 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 	return res;
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT access - Clear a run of FAT entries                               */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT clear_fat (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* Corresponding filesystem object (FAT12/16/32) */
+	DWORD clst,		/* First FAT entry to be cleared */
+	DWORD ncl		/* Number of entries to be cleared (1..) */
+)
+{
+	UINT esz, i, n;
+	BYTE *p;
+	FRESULT res;
+
+
+	res = put_fat(fs, clst, 0);		/* Clear the first entry in the regular way (range check and volume flags) */
+	clst++; ncl--;
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Entries are not aligned to bytes */
+		for ( ; res == FR_OK && ncl; clst++, ncl--) res = put_fat(fs, clst, 0);
+		return res;
+	}
+	esz = (fs->fs_type == FS_FAT16) ? 2 : 4;
+#if FF_FS_MEMFAT
+	if (fs->fatmem) {	/* Clear the entries in memory and mark each sector dirty once */
+		for ( ; res == FR_OK && ncl; clst++, ncl--) {
+			fs->fatmem[clst] &= (esz == 4) ? 0xF0000000 : 0;	/* FAT32: Keep the upper 4 bits */
+			if (clst * esz % SS(fs) == 0) mark_memfat(fs, clst * esz);
+		}
+		return res;
+	}
+#endif
+	while (res == FR_OK && ncl) {	/* Clear the entries in a sector at a time */
+		res = move_window(fs, fs->fatbase + (clst / (SS(fs) / esz)));
+		if (res != FR_OK) break;
+		n = SS(fs) / esz - clst % (SS(fs) / esz);	/* Number of entries to the end of sector */
+		if (n > ncl) n = (UINT)ncl;
+		p = fs->win + clst * esz % SS(fs);
+		if (esz == 2) {
+			mem_set(p, 0, n * 2);
+		} else {
+			for (i = 0; i < n; i++, p += 4) st_dword(p, ld_dword(p) & 0xF0000000);	/* FAT32: Keep the upper 4 bits */
+		}
+		fs->wflag = 1;
+		clst += n; ncl -= n;
+	}
+	return res;
+}
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -1314,6 +1769,42 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 /* exFAT: Accessing FAT and Allocation Bitmap                            */
 /*-----------------------------------------------------------------------*/
 
+/*--------------------------------------*/
+/* Bit operations on a 64-bit bitmap word */
+/*--------------------------------------*/
+
+static UINT pop_qword (	/* Number of bits set */
+	QWORD w
+)
+{
+#if defined(__GNUC__)
+	return (UINT)__builtin_popcountll(w);
+#else
+	UINT n;
+
+	for (n = 0; w; n++) w &= w - 1;
+	return n;
+#endif
+}
+
+
+static UINT ctz_qword (	/* Number of trailing zero bits (64 if no bit set) */
+	QWORD w
+)
+{
+	UINT n;
+
+
+	if (w == 0) return 64;
+#if defined(__GNUC__)
+	n = (UINT)__builtin_ctzll(w);
+#else
+	for (n = 0; !(w & 1); n++) w >>= 1;
+#endif
+	return n;
+}
+
+
 /*--------------------------------------*/
 /* Find a contiguous free cluster block */
 /*--------------------------------------*/
@@ -1324,32 +1815,72 @@ static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:D
 	DWORD ncl	/* Number of contiguous clusters to find (1..) */
 )
 {
-	BYTE bm, bv;
-	UINT i;
-	DWORD val, scl, ctr;
+	QWORD bw;
+	UINT nb, r;
+	DWORD val, scl, ctr, nbit;
 
 
+	nbit = fs->n_fatent - 2;	/* Number of bits in the bitmap */
 	clst -= 2;	/* The first bit in the bitmap corresponds to cluster #2 */
-	if (clst >= fs->n_fatent - 2) clst = 0;
+	if (clst >= nbit) clst = 0;
 	scl = val = clst; ctr = 0;
 	for (;;) {
 		if (move_window(fs, fs->bitbase + val / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
-		i = val / 8 % SS(fs); bm = 1 << (val % 8);
 		do {
-			do {
-				bv = fs->win[i] & bm; bm <<= 1;		/* Get bit value */
-				if (++val >= fs->n_fatent - 2) {	/* Next cluster (with wrap-around) */
-					val = 0; bm = 0; i = SS(fs);
-				}
-				if (bv == 0) {	/* Is it a free cluster? */
-					if (++ctr == ncl) return scl + 2;	/* Check if run length is sufficient for required */
-				} else {
-					scl = val; ctr = 0;		/* Encountered a cluster in-use, restart to scan */
+			bw = ~ld_qword(fs->win + val / 8 % SS(fs) / 8 * 8) >> val % 64;	/* Free bits in the word, from the bit val */
+			nb = 64 - val % 64;					/* Number of bits to check in this word */
+			if (nb > nbit - val) nb = nbit - val;
+			if (val < clst && nb > clst - val) nb = clst - val;	/* Stop at the start point after wrap-around */
+			while (nb > 0) {
+				if (bw & 1) {	/* Run of free clusters */
+					r = ctz_qword(~bw);
+					if (r > nb) r = nb;
+					if (ctr == 0) scl = val;
+					ctr += r;
+					if (ctr >= ncl) return scl + 2;	/* Check if run length is sufficient for required */
+				} else {		/* Run of clusters in-use, restart to scan */
+					r = ctz_qword(bw);
+					if (r > nb) r = nb;
+					ctr = 0;
 				}
-				if (val == clst) return 0;	/* All cluster scanned? */
-			} while (bm != 0);
-			bm = 1;
-		} while (++i < SS(fs));
+				val += r; nb -= r;
+				bw = (r < 64) ? bw >> r : 0;
+			}
+			if (val >= nbit) {		/* Next cluster (with wrap-around) */
+				val = 0; ctr = 0;
+			}
+			if (val == clst) return 0;	/* All cluster scanned? */
+		} while (val % (SS(fs) * 8) != 0);
+	}
+}
+
+
+/*----------------------------------------*/
+/* Measure a run of free clusters         */
+/*----------------------------------------*/
+
+static DWORD run_bitmap (	/* Number of free clusters in a row (1..ncl), 0xFFFFFFFF:Disk error */
+	FATFS* fs,	/* Filesystem object */
+	DWORD clst,	/* Free cluster number to measure from */
+	DWORD ncl	/* Max number of clusters to measure (1..) */
+)
+{
+	UINT b, r;
+	DWORD n = 0;
+
+
+	clst -= 2;	/* The first bit in the bitmap corresponds to cluster #2 */
+	if (ncl > fs->n_fatent - 2 - clst) ncl = fs->n_fatent - 2 - clst;	/* Do not go beyond the bitmap */
+	for (;;) {
+		if (move_window(fs, fs->bitbase + clst / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
+		do {
+			b = clst % 64;
+			r = ctz_qword(ld_qword(fs->win + clst / 8 % SS(fs) / 8 * 8) >> b);	/* Number of free bits from the bit clst */
+			if (r > 64 - b) r = 64 - b;
+			n += r; clst += r;
+			if (n >= ncl) return ncl;
+			if (r < 64 - b) return n;	/* Reached a cluster in-use */
+		} while (clst % (SS(fs) * 8) != 0);
 	}
 }
 
@@ -1365,28 +1896,26 @@ static FRESULT change_bitmap (
 	int bv		/* bit value to be set (0 or 1) */
 )
 {
-	BYTE bm;
-	UINT i;
-	LBA_t sect;
+	QWORD bw, bm;
+	UINT i, n;
 
 
 	clst -= 2;	/* The first bit corresponds to cluster #2 */
-	sect = fs->bitbase + clst / 8 / SS(fs);	/* Sector address */
-	i = clst / 8 % SS(fs);					/* Byte offset in the sector */
-	bm = 1 << (clst % 8);					/* Bit mask in the byte */
-	for (;;) {
-		if (move_window(fs, sect++) != FR_OK) return FR_DISK_ERR;
+	while (ncl) {
+		if (move_window(fs, fs->bitbase + clst / 8 / SS(fs)) != FR_OK) return FR_DISK_ERR;
+		i = clst / 8 % SS(fs) / 8 * 8;		/* Offset of the word in the sector */
 		do {
-			do {
-				if (bv == (int)((fs->win[i] & bm) != 0)) return FR_INT_ERR;	/* Is the bit expected value? */
-				fs->win[i] ^= bm;	/* Flip the bit */
-				fs->wflag = 1;
-				if (--ncl == 0) return FR_OK;	/* All bits processed? */
-			} while (bm <<= 1);		/* Next bit */
-			bm = 1;
-		} while (++i < SS(fs));		/* Next byte */
-		i = 0;
+			n = 64 - clst % 64;				/* Number of bits to change in this word */
+			if (n > ncl) n = ncl;
+			bm = (n == 64) ? ~(QWORD)0 : (((QWORD)1 << n) - 1) << clst % 64;	/* Bit mask of the range */
+			bw = ld_qword(fs->win + i);
+			if (bv ? (bw & bm) : (~bw & bm)) return FR_INT_ERR;	/* Are the bits expected value? */
+			st_qword(fs->win + i, bw ^ bm);	/* Flip the bits */
+			fs->wflag = 1;
+			clst += n; ncl -= n; i += 8;
+		} while (ncl && i < SS(fs));	/* Next word */
 	}
+	return FR_OK;
 }
 
 
@@ -1450,11 +1979,8 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 )
 {
 	FRESULT res = FR_OK;
-	DWORD nxt;
+	DWORD nxt, scl, ecl, n;
 	FATFS *fs = obj->fs;
-#if FF_FS_EXFAT || FF_USE_TRIM
-	DWORD scl = clst, ecl = clst;
-#endif
 #if FF_USE_TRIM
 	LBA_t rt[2];
 #endif
@@ -1467,27 +1993,26 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 		if (res != FR_OK) return res;
 	}
 
-	/* Remove the chain */
-	do {
+	/* Remove the chain in runs of contiguous clusters */
+	for (scl = clst; ; clst = nxt) {
 		nxt = get_fat(obj, clst);			/* Get cluster status */
-		if (nxt == 0) break;				/* Empty cluster? */
 		if (nxt == 1) return FR_INT_ERR;	/* Internal error? */
 		if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error? */
-		if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
-			res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
-			if (res != FR_OK) return res;
-		}
-		if (fs->free_clst < fs->n_fatent - 2) {	/* Update FSINFO */
-			fs->free_clst++;
-			fs->fsi_flag |= 1;
-		}
-#if FF_FS_EXFAT || FF_USE_TRIM
-		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
-			ecl = nxt;
-		} else {				/* End of contiguous cluster block */
+		if (nxt == clst + 1 && nxt < fs->n_fatent) continue;	/* Extend the run if next cluster is contiguous */
+		ecl = (nxt == 0) ? clst - 1 : clst;	/* Last cluster of the run (current one is not in the chain if empty) */
+		if (ecl >= scl) {
+			n = ecl - scl + 1;
+			if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
+				res = clear_fat(fs, scl, n);	/* Mark the cluster block 'free' on the FAT */
+				if (res != FR_OK) return res;
+			}
+			if (fs->free_clst < fs->n_fatent - 2) {	/* Update FSINFO */
+				fs->free_clst = (fs->free_clst + n < fs->n_fatent - 2) ? fs->free_clst + n : fs->n_fatent - 2;
+				fs->fsi_flag |= 1;
+			}
 #if FF_FS_EXFAT
 			if (fs->fs_type == FS_EXFAT) {
-				res = change_bitmap(fs, scl, ecl - scl + 1, 0);	/* Mark the cluster block 'free' on the bitmap */
+				res = change_bitmap(fs, scl, n, 0);	/* Mark the cluster block 'free' on the bitmap */
 				if (res != FR_OK) return res;
 			}
 #endif
@@ -1496,11 +2021,10 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			rt[1] = clst2sect(fs, ecl) + fs->csize - 1;	/* End of data area to be freed */
 			disk_ioctl(fs->pdrv, CTRL_TRIM, rt);		/* Inform storage device that the data in the block may be erased */
 #endif
-			scl = ecl = nxt;
 		}
-#endif
-		clst = nxt;					/* Next cluster */
-	} while (clst < fs->n_fatent);	/* Repeat while not the last link */
+		if (nxt == 0 || nxt >= fs->n_fatent) break;	/* End of the chain? */
+		scl = nxt;							/* Start a new run */
+	}
 
 #if FF_FS_EXFAT
 	/* Some post processes for chain status */
@@ -1538,12 +2062,13 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 /* FAT handling - Stretch a chain or Create a new chain                  */
 /*-----------------------------------------------------------------------*/
 
-static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+static DWORD create_run (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:First cluster# of the run */
 	FFOBJID* obj,		/* Corresponding object */
-	DWORD clst			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD clst,			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD* nrun			/* [IN] Number of clusters wanted (1..), [OUT] Number of clusters allocated */
 )
 {
-	DWORD cs, ncl, scl;
+	DWORD cs, ncl, scl, n;
 	FRESULT res;
 	FATFS *fs = obj->fs;
 
@@ -1556,7 +2081,10 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 		cs = get_fat(obj, clst);			/* Check the cluster status */
 		if (cs < 2) return 1;				/* Test for insanity */
 		if (cs == 0xFFFFFFFF) return cs;	/* Test for disk error */
-		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
+		if (cs < fs->n_fatent) {			/* It is already followed by next cluster */
+			*nrun = 1;
+			return cs;
+		}
 		scl = clst;							/* Cluster to start to find */
 	}
 	if (fs->free_clst == 0) return 0;		/* No free cluster */
@@ -1565,7 +2093,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 		ncl = find_bitmap(fs, scl, 1);				/* Find a free cluster */
 		if (ncl == 0 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or hard error? */
-		res = change_bitmap(fs, ncl, 1, 1);			/* Mark the cluster 'in use' */
+		n = run_bitmap(fs, ncl, *nrun);				/* Take the free clusters following it */
+		if (n == 0xFFFFFFFF) return n;
+		res = change_bitmap(fs, ncl, n, 1);			/* Mark the clusters 'in use' */
 		if (res == FR_INT_ERR) return 1;
 		if (res == FR_DISK_ERR) return 0xFFFFFFFF;
 		if (clst == 0) {							/* Is it a new chain? */
@@ -1577,12 +2107,12 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 		if (obj->stat != 2) {	/* Is the file non-contiguous? */
-			if (ncl == clst + 1) {	/* Is the cluster next to previous one? */
-				obj->n_frag = obj->n_frag ? obj->n_frag + 1 : 2;	/* Increment size of last framgent */
+			if (ncl == clst + 1) {	/* Is the run next to previous one? */
+				obj->n_frag = obj->n_frag ? obj->n_frag + n : n + 1;	/* Increment size of last framgent */
 			} else {				/* New fragment */
 				if (obj->n_frag == 0) obj->n_frag = 1;
 				res = fill_last_frag(obj, clst, ncl);	/* Fill last fragment on the FAT and link it to new one */
-				if (res == FR_OK) obj->n_frag = 1;
+				if (res == FR_OK) obj->n_frag = n;
 			}
 		}
 	} else
@@ -1614,21 +2144,43 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 				if (ncl == scl) return 0;		/* No free cluster found? */
 			}
 		}
-		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
+		for (n = 1; n < *nrun && ncl + n < fs->n_fatent; n++) {	/* Take the free clusters following it */
+			cs = get_fat(obj, ncl + n);
+			if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+			if (cs != 0) break;
+		}
+		cs = ncl + n - 1;
+		res = put_fat(fs, cs, 0xFFFFFFFF);		/* Mark the last cluster of the run 'EOC' */
+		for ( ; res == FR_OK && cs > ncl; cs--) {
+			res = put_fat(fs, cs - 1, cs);		/* Link the run backward in a pass over the FAT sectors */
+		}
 		if (res == FR_OK && clst != 0) {
 			res = put_fat(fs, clst, ncl);		/* Link it from the previous one if needed */
 		}
 	}
 
 	if (res == FR_OK) {			/* Update FSINFO if function succeeded. */
-		fs->last_clst = ncl;
-		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst--;
+		fs->last_clst = ncl + n - 1;
+		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst -= n;
 		fs->fsi_flag |= 1;
+		*nrun = n;
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
 	}
 
-	return ncl;		/* Return new cluster number or error status */
+	return ncl;		/* Return first cluster number of the run or error status */
+}
+
+
+static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FFOBJID* obj,		/* Corresponding object */
+	DWORD clst			/* Cluster# to stretch, 0:Create a new chain */
+)
+{
+	DWORD n = 1;
+
+
+	return create_run(obj, clst, &n);
 }
 
 #endif /* !FF_FS_READONLY */
@@ -1661,11 +2213,131 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	return cl + *tbl;	/* Return the cluster number */
 }
 
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create cluster link map table of the file              */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT create_clmt (	/* FR_OK(0), FR_NOT_ENOUGH_CORE:Given table is too small, FR_INT_ERR or FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object with the table given */
+)
+{
+	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+	cl = fp->obj.sclust;		/* Origin of the chain */
+	if (cl != 0) {
+		do {
+			/* Get a fragment */
+			tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
+			do {
+				pcl = cl; ncl++;
+				cl = get_fat(&fp->obj, cl);
+				if (cl <= 1) return FR_INT_ERR;
+				if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			} while (cl == pcl + 1);
+			if (ulen <= tlen) {		/* Store the length and top of the fragment */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fs->n_fatent);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;	/* Number of items used */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+	*tbl = 0;		/* Terminate table */
+	return FR_OK;
+}
+
+
+#if FF_USE_FASTSEEK == 2
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create/Discard the automatic cluster link map table    */
+/*-----------------------------------------------------------------------*/
+
+static void free_clmt (
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	if (fp->autotbl) {
+		if (fp->cltbl == fp->autotbl) fp->cltbl = 0;	/* Leave fast seek mode */
+		ff_memfree(fp->autotbl);
+		fp->autotbl = 0;
+	}
+}
+
+
+static FRESULT auto_clmt (	/* FR_OK(0):Created or not enough memory, FR_INT_ERR or FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	DWORD tlen = 64;	/* Initial table size in items */
+	FRESULT res;
+
+
+	if (fp->cltbl || fp->obj.sclust == 0) return FR_OK;	/* Given by application or no cluster chain */
+	for (;;) {
+		fp->autotbl = ff_memalloc((UINT)(tlen * sizeof (DWORD)));
+		if (!fp->autotbl) return FR_OK;	/* Follow the FAT if not enough memory */
+		fp->cltbl = fp->autotbl;
+		fp->cltbl[0] = tlen;
+		res = create_clmt(fp);
+		if (res != FR_NOT_ENOUGH_CORE) break;
+		tlen = fp->cltbl[0];	/* Retry with the required size */
+		free_clmt(fp);
+	}
+	if (res != FR_OK) free_clmt(fp);
+	return res;
+}
+#endif
+
 #endif	/* FF_USE_FASTSEEK */
 
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Count clusters contiguously following the current one  */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT follow_run (	/* FR_OK(0) or FR_DISK_ERR */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD* ncl		/* [IN] Max number of clusters to look ahead, [OUT] Number of clusters following fp->clust contiguously */
+)
+{
+	DWORD cl, nx, n;
+#if FF_USE_FASTSEEK
+	DWORD ci, *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	if (fp->cltbl) {	/* Get remaining length of the fragment from the CLMT */
+		tbl = fp->cltbl + 1;
+		ci = (DWORD)(fp->fptr / SS(fs) / fs->csize);	/* Cluster order from top of the file */
+		for (n = 0; (nx = *tbl++) != 0; tbl++) {
+			if (ci < nx) {
+				n = nx - ci - 1;
+				break;
+			}
+			ci -= nx;
+		}
+		if (n < *ncl) *ncl = n;
+		return FR_OK;
+	}
+#endif
+	for (cl = fp->clust, n = 0; n < *ncl; n++, cl++) {	/* Follow the FAT while the chain is contiguous */
+		nx = get_fat(&fp->obj, cl);
+		if (nx == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (nx != cl + 1) break;
+	}
+	*ncl = n;
+	return FR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Fill a cluster with zeros                        */
 /*-----------------------------------------------------------------------*/
@@ -1814,6 +2486,38 @@ static FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DEN
 
 
 
+#if FF_FS_DIRHINT && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find the free entry hint of a directory          */
+/*-----------------------------------------------------------------------*/
+
+static DWORD* dir_hint (	/* Pointer to the hint (NULL:not found) */
+	FATFS* fs,				/* Filesystem object */
+	DWORD clst,				/* Start cluster of the directory (0:FAT12/16 root directory) */
+	int alloc				/* Assign a slot to the directory if not found */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRHINT; i++) {
+		if (fs->dhclst[i] == clst) return &fs->dhofs[i];
+	}
+	if (!alloc) return 0;
+	i = fs->dhnext; fs->dhnext = (BYTE)((i + 1) % FF_FS_DIRHINT);	/* Reuse the slots in round-robin */
+	fs->dhclst[i] = clst;
+	fs->dhofs[i] = 0;		/* Scan it from the top at first */
+#if FF_USE_LFN
+	fs->dhseq[i] = 0;		/* No numbered name yet */
+#endif
+	return &fs->dhofs[i];
+}
+
+#endif
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Reserve a block of directory entries             */
@@ -1827,9 +2531,18 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 	FRESULT res;
 	UINT n;
 	FATFS *fs = dp->obj.fs;
+#if FF_FS_DIRHINT
+	DWORD *hint = dir_hint(fs, dp->obj.sclust, 1);
+	DWORD fre = 0xFFFFFFFF;
+
+
+	res = dir_sdi(dp, *hint);		/* Start at the first entry that can be free */
+	if (res != FR_OK) res = dir_sdi(dp, 0);	/* Scan it from the top if the hint is out of the table */
+#else
 
 
 	res = dir_sdi(dp, 0);
+#endif
 	if (res == FR_OK) {
 		n = 0;
 		do {
@@ -1839,6 +2552,9 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 			if ((fs->fs_type == FS_EXFAT) ? (int)((dp->dir[XDIR_Type] & 0x80) == 0) : (int)(dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0)) {	/* Is the entry free? */
 #else
 			if (dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0) {	/* Is the entry free? */
+#endif
+#if FF_FS_DIRHINT
+				if (fre == 0xFFFFFFFF) fre = dp->dptr;	/* First free entry found */
 #endif
 				if (++n == n_ent) break;	/* Is a block of contiguous free entries found? */
 			} else {
@@ -1847,6 +2563,11 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 			res = dir_next(dp, 1);	/* Next entry with table stretch enabled */
 		} while (res == FR_OK);
 	}
+#if FF_FS_DIRHINT
+	if (res == FR_OK) {		/* Advance the hint past the block if no free entry is left in front of it */
+		*hint = (fre == dp->dptr - (n_ent - 1) * SZDIRE) ? dp->dptr + SZDIRE : fre;
+	}
+#endif
 
 	if (res == FR_NO_FILE) res = FR_DENIED;	/* No directory entry to allocate */
 	return res;
@@ -2249,7 +2970,7 @@ static void init_alloc_info (
 
 
 
-#if !FF_FS_READONLY || FF_FS_RPATH != 0
+#if !FF_FS_READONLY || FF_FS_RPATH != 0 || FF_FS_DCACHE
 /*------------------------------------------------*/
 /* exFAT: Load the object's directory entry block */
 /*------------------------------------------------*/
@@ -2427,11 +3148,254 @@ static FRESULT dir_read (
 		if (res != FR_OK) break;
 	}
 
-	if (res != FR_OK) dp->sect = 0;		/* Terminate the read operation on error or EOT */
-	return res;
+	if (res != FR_OK) dp->sect = 0;		/* Terminate the read operation on error or EOT */
+	return res;
+}
+
+#endif	/* FF_FS_MINIMIZE <= 1 || FF_USE_LABEL || FF_FS_RPATH >= 2 */
+
+
+
+#if FF_FS_DIRIDX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Hashed index of the object names                 */
+/*-----------------------------------------------------------------------*/
+/* An index is a DWORD array of the number of slots - 1, the number of used
+/  slots, the number of live slots and a reserved word, followed by the slots
+/  of a name key (0:empty) and the offset of the entry block (0xFFFFFFFF:
+/  removed). The index only tells dir_find() where to look, and the name is
+/  always checked on the entries. It is built after a search has missed. */
+
+#define IDX_MIN		256			/* Initial number of slots in an index (power of 2) */
+#define IDX_MAX		0x400000	/* Max number of slots in an index (the index is dropped beyond it) */
+
+static DWORD key_sfn (	/* Returns the name key of an SFN */
+	const BYTE* sfn		/* Pointer to the SFN (11 bytes) */
+)
+{
+	DWORD key = 0x811C9DC5;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) key = (key ^ sfn[i]) * 0x01000193;	/* FNV-1a */
+	return key | 1;
+}
+
+
+#if FF_USE_LFN
+static DWORD key_wchar (	/* Returns the term of a character (the key of an LFN is the sum of the terms | 1) */
+	UINT i,				/* Position of the character in the name */
+	WCHAR wc			/* Character (case-folded here) */
+)
+{
+	DWORD h = (ff_wtoupper(wc) << 8 ^ i) * 0x9E3779B1;
+
+
+	return h ^ h >> 15;
+}
+
+
+static DWORD key_lfnent (	/* Returns the sum of the terms of the characters in an LFN entry */
+	const BYTE* dir		/* Pointer to the LFN entry */
+)
+{
+	UINT i, s;
+	WCHAR wc;
+	DWORD h = 0;
+
+
+	i = ((dir[LDIR_Ord] & 0x3F) - 1) * 13;	/* Offset in the name */
+	for (s = 0; s < 13 && (wc = ld_word(dir + LfnOfs[s])) != 0; s++) h += key_wchar(i + s, wc);
+	return h;
+}
+#endif
+
+
+static DWORD* put_index (	/* Returns the index (it can be moved) or NULL:not enough memory (the index is freed) */
+	DWORD* ix,			/* Index, or NULL to create a new one */
+	DWORD key,			/* Name key (0:create an empty index with IDX_MIN slots) */
+	DWORD ofs			/* Offset of the entry block */
+)
+{
+	DWORD *nx = 0, i, n;
+
+
+	n = ix ? ix[0] + 1 : IDX_MIN;
+	if (!ix || (ix[1] + 1) * 2 > n) {	/* Create a new index or rehash it if half of the slots are used */
+		if (ix && ix[2] * 4 >= n) n *= 2;	/* Double it if a quarter is live, or purge the removed slots at the same size */
+		if (n <= IDX_MAX) nx = ff_memalloc((UINT)((n + 2) * 8));
+		if (nx) {
+			mem_set(nx, 0, (UINT)((n + 2) * 8));
+			nx[0] = n - 1;
+			for (i = 0; ix && i <= ix[0]; i++) {	/* Move the live slots to the new index */
+				if (ix[4 + i * 2] && ix[5 + i * 2] != 0xFFFFFFFF) nx = put_index(nx, ix[4 + i * 2], ix[5 + i * 2]);
+			}
+		}
+		if (ix) ff_memfree(ix);
+		ix = nx;
+		if (!ix) return 0;
+	}
+	if (key) {
+		for (i = (key ^ key >> 16) & ix[0]; ix[4 + i * 2] && ix[5 + i * 2] != 0xFFFFFFFF; i = (i + 1) & ix[0]) ;	/* Find an empty or removed slot */
+		if (!ix[4 + i * 2]) ix[1]++;
+		ix[4 + i * 2] = key; ix[5 + i * 2] = ofs;
+		ix[2]++;
+	}
+	return ix;
+}
+
+
+static DWORD* dir_index (	/* Returns the index of the directory or NULL:not available */
+	DIR* dp,			/* Directory object */
+	int build			/* Build the index if not available */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD *ix;
+	UINT i;
+	BYTE c;
+#if FF_USE_LFN
+	BYTE a, ord = 0xFF, sum = 0xFF;
+	DWORD lh = 0, blk = 0xFFFFFFFF;
+#endif
+
+
+	for (i = 0; i < FF_FS_DIRIDX; i++) {
+		if (fs->dxtbl[i] && fs->dxclst[i] == dp->obj.sclust) return fs->dxtbl[i];
+	}
+	if (!build) return 0;
+
+	/* Build the index in a pass over the directory */
+	ix = put_index(0, 0, 0);
+	res = ix ? dir_sdi(dp, 0) : FR_NOT_ENOUGH_CORE;
+	while (res == FR_OK) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Key is the name hash in the stream extension entry */
+			if (c == ET_FILEDIR) blk = dp->dptr;
+			if (c == ET_STREAM && blk == dp->dptr - SZDIRE) ix = put_index(ix, ld_word(dp->dir + XDIR_NameHash - SZDIRE) | 0x10000, blk);
+		} else
+#endif
+		{
+#if FF_USE_LFN		/* LFN configuration (the same sequence check as dir_scan) */
+			a = dp->dir[DIR_Attr] & AM_MASK;
+			if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+				ord = 0xFF; blk = 0xFFFFFFFF;
+			} else {
+				if (a == AM_LFN) {			/* An LFN entry */
+					if (c & LLEF) {
+						sum = dp->dir[LDIR_Chksum];
+						c &= (BYTE)~LLEF; ord = c;
+						blk = dp->dptr; lh = 0;
+					}
+					if (c == ord && sum == dp->dir[LDIR_Chksum] && ld_word(dp->dir + LDIR_FstClusLO) == 0) {
+						lh += key_lfnent(dp->dir); ord--;
+					} else {
+						ord = 0xFF;
+					}
+				} else {					/* An SFN entry */
+					if (blk == 0xFFFFFFFF) blk = dp->dptr;
+					ix = put_index(ix, key_sfn(dp->dir), blk);
+					if (ix && ord == 0 && sum == sum_sfn(dp->dir)) ix = put_index(ix, lh | 1, blk);
+					ord = 0xFF; blk = 0xFFFFFFFF;
+				}
+			}
+#else				/* Non LFN configuration */
+			if (c != DDEM && !(dp->dir[DIR_Attr] & AM_VOL)) ix = put_index(ix, key_sfn(dp->dir), dp->dptr);
+#endif
+		}
+		res = ix ? dir_next(dp, 0) : FR_NOT_ENOUGH_CORE;
+	}
+	if (res != FR_NO_FILE) {	/* Give up the index on error */
+		if (ix) ff_memfree(ix);
+		return 0;
+	}
+	i = fs->dxnext; fs->dxnext = (BYTE)((i + 1) % FF_FS_DIRIDX);	/* Register it to the filesystem object in round-robin */
+	if (fs->dxtbl[i]) ff_memfree(fs->dxtbl[i]);
+	fs->dxtbl[i] = ix; fs->dxclst[i] = dp->obj.sclust;
+	return ix;
+}
+
+
+#if !FF_FS_READONLY
+static void add_index (
+	DIR* dp,			/* Directory object */
+	DWORD key,			/* Name key */
+	DWORD ofs			/* Offset of the entry block */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRIDX; i++) {	/* Update the index if the directory has one */
+		if (fs->dxtbl[i] && fs->dxclst[i] == dp->obj.sclust) {
+			fs->dxtbl[i] = put_index(fs->dxtbl[i], key, ofs);	/* It is discarded if not enough memory */
+			break;
+		}
+	}
+}
+
+
+static void del_index (
+	DIR* dp,			/* Directory object */
+	DWORD key,			/* Name key */
+	DWORD ofs			/* Offset of the entry block */
+)
+{
+	DWORD *ix, i;
+
+
+	ix = dir_index(dp, 0);
+	if (ix) {
+		for (i = (key ^ key >> 16) & ix[0]; ix[4 + i * 2]; i = (i + 1) & ix[0]) {
+			if (ix[4 + i * 2] == key && ix[5 + i * 2] == ofs) {
+				ix[5 + i * 2] = 0xFFFFFFFF;		/* Mark the slot removed */
+				ix[2]--;
+				break;
+			}
+		}
+	}
+}
+
+
+static void drop_index (
+	FATFS* fs,			/* Filesystem object */
+	DWORD clst			/* Start cluster of the removed directory */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRIDX; i++) {
+		if (fs->dxtbl[i] && fs->dxclst[i] == clst) {
+			ff_memfree(fs->dxtbl[i]);
+			fs->dxtbl[i] = 0;
+		}
+	}
+}
+#endif
+
+
+static void free_index (
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DIRIDX; i++) {
+		if (fs->dxtbl[i]) ff_memfree(fs->dxtbl[i]);
+		fs->dxtbl[i] = 0;
+	}
 }
 
-#endif	/* FF_FS_MINIMIZE <= 1 || FF_USE_LABEL || FF_FS_RPATH >= 2 */
+#endif	/* FF_FS_DIRIDX */
+
 
 
 
@@ -2439,8 +3403,9 @@ static FRESULT dir_read (
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT dir_scan (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object with the file name, pointing the entry to start */
+	DWORD lim				/* Stop after the object at this offset (0xFFFFFFFF:to the end of table) */
 )
 {
 	FRESULT res;
@@ -2450,15 +3415,13 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 		BYTE nc;
 		UINT di, ni;
 		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
 
-		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+		while ((res = (dp->dptr <= lim) ? DIR_READ_FILE(dp) : FR_NO_FILE) == FR_OK) {	/* Read an item */
 #if FF_MAX_LFN < 255
 			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
 #endif
@@ -2485,6 +3448,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
 		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
 			ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+			if (dp->dptr >= lim) { res = FR_NO_FILE; break; }	/* End of the objects to be examined */
 		} else {
 			if (a == AM_LFN) {			/* An LFN entry is found */
 				if (!(dp->fn[NSFLAG] & NS_NOLFN)) {
@@ -2500,11 +3464,13 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				if (ord == 0 && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
 				if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* SFN matched? */
 				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+				if (dp->dptr >= lim) { res = FR_NO_FILE; break; }	/* End of the objects to be examined */
 			}
 		}
 #else		/* Non LFN configuration */
 		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+		if (dp->dptr >= lim) { res = FR_NO_FILE; break; }	/* End of the objects to be examined */
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
@@ -2513,6 +3479,64 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 }
 
 
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if FF_FS_DIRIDX
+#if FF_USE_LFN
+	FATFS *fs = dp->obj.fs;
+#endif
+	DWORD *ix, key[2], i;
+	UINT k;
+
+
+	if (!(dp->fn[NSFLAG] & NS_DOT) && (ix = dir_index(dp, 0)) != 0) {	/* Look up the index if available */
+		key[0] = key[1] = 0;
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {
+			key[0] = xname_sum(fs->lfnbuf) | 0x10000;
+		} else
+#endif
+		{
+#if FF_USE_LFN
+			if (!(dp->fn[NSFLAG] & NS_NOLFN)) {	/* Key of the LFN */
+				for (key[0] = 0, i = 0; fs->lfnbuf[i]; i++) key[0] += key_wchar((UINT)i, fs->lfnbuf[i]);
+				key[0] |= 1;
+			}
+			if (!(dp->fn[NSFLAG] & NS_LOSS)) key[1] = key_sfn(dp->fn);	/* Key of the SFN */
+#else
+			key[1] = key_sfn(dp->fn);
+#endif
+		}
+		for (k = 0; k < 2; k++) {
+			if (!key[k]) continue;
+			for (i = (key[k] ^ key[k] >> 16) & ix[0]; ix[4 + i * 2]; i = (i + 1) & ix[0]) {	/* Check each object with the key */
+				if (ix[4 + i * 2] != key[k] || ix[5 + i * 2] == 0xFFFFFFFF) continue;
+				res = dir_sdi(dp, ix[5 + i * 2]);
+				if (res == FR_OK) res = dir_scan(dp, ix[5 + i * 2]);
+				if (res == FR_OK || res == FR_DISK_ERR) return res;
+			}
+		}
+		return FR_NO_FILE;
+	}
+#endif
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+	res = dir_scan(dp, 0xFFFFFFFF);
+#if FF_FS_DIRIDX
+	if (res == FR_NO_FILE && !(dp->fn[NSFLAG] & NS_DOT)) {	/* The whole directory has been scanned in vain: index it for the next searches */
+		DIR dj;
+
+		mem_cpy(&dj, dp, sizeof (DIR));	/* Keep the directory object as the search left it */
+		dir_index(&dj, 1);
+	}
+#endif
+	return res;
+}
+
+
 
 
 #if !FF_FS_READONLY
@@ -2529,6 +3553,12 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 #if FF_USE_LFN		/* LFN configuration */
 	UINT n, len, n_ent;
 	BYTE sn[12], sum;
+#if FF_FS_DIRIDX
+	DWORD lh;
+#endif
+#if FF_FS_DIRHINT
+	UINT i, n0 = 1;
+#endif
 
 
 	if (dp->fn[NSFLAG] & (NS_DOT | NS_NONAME)) return FR_INVALID_NAME;	/* Check name validity */
@@ -2562,6 +3592,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 		}
 
 		create_xdir(fs->dirbuf, fs->lfnbuf);	/* Create on-memory directory block to be written later */
+#if FF_FS_DIRIDX
+		add_index(dp, ld_word(fs->dirbuf + XDIR_NameHash) | 0x10000, dp->blk_ofs);
+#endif
 		return FR_OK;
 	}
 #endif
@@ -2569,13 +3602,26 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	mem_cpy(sn, dp->fn, 12);
 	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
 		dp->fn[NSFLAG] = NS_NOLFN;		/* Find only SFN */
+#if FF_FS_DIRHINT
+		i = (UINT)(dir_hint(fs, dp->obj.sclust, 1) - fs->dhofs);
+		if (fs->dhseq[i] && !mem_cmp(fs->dhsfn[i], sn, 11)) n0 = fs->dhseq[i];	/* Skip the numbers found taken by the last one */
+		for (n = n0; n < n0 + 99; n++) {
+#else
 		for (n = 1; n < 100; n++) {
+#endif
 			gen_numname(dp->fn, sn, fs->lfnbuf, n);	/* Generate a numbered name */
 			res = dir_find(dp);				/* Check if the name collides with existing SFN */
 			if (res != FR_OK) break;
 		}
+#if FF_FS_DIRHINT
+		if (n == n0 + 99) return FR_DENIED;	/* Abort if too many collisions */
+		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
+		mem_cpy(fs->dhsfn[i], sn, 11);		/* Start at this number for the same SFN next time */
+		fs->dhseq[i] = (BYTE)((n < 100) ? n : 6);
+#else
 		if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
 		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
+#endif
 		dp->fn[NSFLAG] = sn[NSFLAG];
 	}
 
@@ -2613,6 +3659,21 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			fs->wflag = 1;
 		}
 	}
+#if FF_FS_DIRIDX
+	if (res == FR_OK) {	/* Add the names to the index of the directory */
+#if FF_USE_LFN
+		if (sn[NSFLAG] & NS_LFN) {
+			n_ent = (len + 12) / 13;	/* Number of LFN entries in front of the SFN entry */
+			for (lh = 0, n = 0; n < len; n++) lh += key_wchar(n, fs->lfnbuf[n]);
+			add_index(dp, lh | 1, dp->dptr - n_ent * SZDIRE);
+			add_index(dp, key_sfn(dp->fn), dp->dptr - n_ent * SZDIRE);
+		} else
+#endif
+		{
+			add_index(dp, key_sfn(dp->fn), dp->dptr);
+		}
+	}
+#endif
 
 	return res;
 }
@@ -2632,14 +3693,35 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 {
 	FRESULT res;
 	FATFS *fs = dp->obj.fs;
+#if FF_FS_DIRHINT
+	DWORD *hint = dir_hint(fs, dp->obj.sclust, 0);
+#endif
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
+#if FF_FS_DIRIDX
+	DWORD blk = (dp->blk_ofs == 0xFFFFFFFF) ? last : dp->blk_ofs, lh = 0;
+#endif
 
+#if FF_FS_DIRHINT
+	if (hint && *hint > ((dp->blk_ofs == 0xFFFFFFFF) ? last : dp->blk_ofs)) {	/* Move back the hint to the entries to be freed */
+		*hint = (dp->blk_ofs == 0xFFFFFFFF) ? last : dp->blk_ofs;
+	}
+#endif
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
 			res = move_window(fs, dp->sect);
 			if (res != FR_OK) break;
+#if FF_FS_DIRIDX
+			if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {	/* Remove the names from the index of the directory */
+				if (dp->dir[XDIR_Type] == ET_STREAM) del_index(dp, ld_word(dp->dir + XDIR_NameHash - SZDIRE) | 0x10000, blk);
+			} else if (dp->dptr < last) {
+				lh += key_lfnent(dp->dir);
+			} else {
+				if (dp->blk_ofs != 0xFFFFFFFF) del_index(dp, lh | 1, blk);
+				del_index(dp, key_sfn(dp->dir), blk);
+			}
+#endif
 			if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 				dp->dir[XDIR_Type] &= 0x7F;	/* Clear the entry InUse flag. */
 			} else {									/* On the FAT/FAT32 volume */
@@ -2653,8 +3735,14 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 	}
 #else			/* Non LFN configuration */
 
+#if FF_FS_DIRHINT
+	if (hint && *hint > dp->dptr) *hint = dp->dptr;	/* Move back the hint to the entry to be freed */
+#endif
 	res = move_window(fs, dp->sect);
 	if (res == FR_OK) {
+#if FF_FS_DIRIDX
+		del_index(dp, key_sfn(dp->dir), dp->dptr);	/* Remove the name from the index of the directory */
+#endif
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
 		fs->wflag = 1;
 	}
@@ -3058,6 +4146,163 @@ static FRESULT create_name (	/* FR_OK: successful, FR_INVALID_NAME: could not cr
 
 
 
+#if FF_FS_DCACHE
+/*-----------------------------------------------------------------------*/
+/* Path resolution cache                                                 */
+/*-----------------------------------------------------------------------*/
+/* The cache maps the path prefixes followed from an origin directory to the
+/  sub-directories they lead to. A prefix is kept with the separators merged
+/  into a '/' and the ASCII letters in upper case, and a DBC as it is. */
+
+static UINT put_dcpath (	/* Returns length of the cached form of the path prefix */
+	TCHAR* dst,			/* Buffer to store it (null:get the length only) */
+	const TCHAR* src,	/* Top of the path prefix */
+	const TCHAR* end	/* End of the path prefix */
+)
+{
+	TCHAR c;
+	UINT n = 0;
+
+
+	while (src < end) {
+		c = *src++;
+		if (c == '/' || c == '\\') {
+			while (src < end && (*src == '/' || *src == '\\')) src++;
+			if (src == end) break;		/* Strip the trailing separator */
+			c = '/';
+		} else {
+#if FF_LFN_UNICODE == 0 && (FF_CODE_PAGE == 0 || FF_CODE_PAGE >= 900)
+			if (dbc_1st((BYTE)c) && src < end) {	/* Store a DBC as it is */
+				if (dst) dst[n] = c;
+				n++; c = *src++;
+			} else
+#endif
+			if (IsLower(c)) c -= 0x20;
+		}
+		if (dst) dst[n] = c;
+		n++;
+	}
+	if (dst) dst[n] = 0;
+	return n;
+}
+
+
+static const TCHAR* cmp_dcpath (	/* Returns the rest of the path following the cached prefix (null:not matched) */
+	const TCHAR* sp,	/* Cached path prefix */
+	const TCHAR* path	/* Path to be followed */
+)
+{
+	TCHAR c;
+
+
+	while (*sp) {
+		c = *path++;
+		if (c == '/' || c == '\\') {
+			while (*path == '/' || *path == '\\') path++;
+			c = '/';
+		} else {
+#if FF_LFN_UNICODE == 0 && (FF_CODE_PAGE == 0 || FF_CODE_PAGE >= 900)
+			if (dbc_1st((BYTE)c) && *path) {	/* Compare a DBC as it is */
+				if (c != *sp++ || *path != *sp) return 0;
+				path++; sp++;
+				continue;
+			}
+#endif
+			if (IsLower(c)) c -= 0x20;
+		}
+		if (c != *sp++) return 0;
+	}
+	if (*path != '/' && *path != '\\') return 0;	/* Not at a segment boundary */
+	do path++; while (*path == '/' || *path == '\\');
+	return ((UINT)*path < ' ') ? 0 : path;	/* The last segment needs to be followed anyway */
+}
+
+
+static FRESULT find_dcache (
+	DIR* dp,			/* Directory object at the origin directory */
+	const TCHAR** path	/* Pointer to the path to be followed, returns the rest of the path */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	const TCHAR *rp, *np = *path;
+	UINT i, hit = FF_FS_DCACHE;
+
+
+	for (i = 0; i < FF_FS_DCACHE; i++) {	/* Find the longest prefix of the path in the cache */
+		if (fs->dcpath[i] && fs->dcorg[i] == dp->obj.sclust) {
+			rp = cmp_dcpath(fs->dcpath[i], *path);
+			if (rp && rp > np) {
+				np = rp; hit = i;
+			}
+		}
+	}
+	if (hit < FF_FS_DCACHE) {			/* Open the sub-directory the prefix leads to */
+#if FF_FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Retrieve the sub-directory's status */
+			DIR dj;
+			FRESULT res;
+
+			dp->obj.c_scl = fs->dcc_scl[hit];
+			dp->obj.c_size = fs->dcc_size[hit];
+			dp->obj.c_ofs = fs->dcc_ofs[hit];
+			res = load_obj_xdir(&dj, &dp->obj);
+			if (res != FR_OK) return res;
+			init_alloc_info(fs, &dp->obj);
+		}
+#endif
+		dp->obj.sclust = fs->dcclst[hit];
+		*path = np;
+	}
+	return FR_OK;
+}
+
+
+static void add_dcache (
+	DIR* dp,			/* Directory object at the sub-directory reached */
+	DWORD org,			/* Origin directory */
+	const TCHAR* top,	/* Top of the path prefix followed */
+	const TCHAR* end	/* End of the path prefix followed */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	TCHAR *sp;
+	UINT i;
+
+
+	sp = ff_memalloc((put_dcpath(0, top, end) + 1) * sizeof (TCHAR));
+	if (!sp) return;					/* The prefix is not cached if not enough memory */
+	put_dcpath(sp, top, end);
+	i = fs->dcnext; fs->dcnext = (BYTE)((i + 1) % FF_FS_DCACHE);	/* Register it in round-robin */
+	if (fs->dcpath[i]) ff_memfree(fs->dcpath[i]);
+	fs->dcpath[i] = sp;
+	fs->dcorg[i] = org;
+	fs->dcclst[i] = dp->obj.sclust;
+#if FF_FS_EXFAT
+	fs->dcc_scl[i] = dp->obj.c_scl;
+	fs->dcc_size[i] = dp->obj.c_size;
+	fs->dcc_ofs[i] = dp->obj.c_ofs;
+#endif
+}
+
+
+static void free_dcache (	/* Forget all paths (on removal or move of a directory, and unmount) */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DCACHE; i++) {
+		if (fs->dcpath[i]) ff_memfree(fs->dcpath[i]);
+		fs->dcpath[i] = 0;
+	}
+}
+
+#endif	/* FF_FS_DCACHE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Follow a file path                                                    */
 /*-----------------------------------------------------------------------*/
@@ -3070,6 +4315,10 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 	FRESULT res;
 	BYTE ns;
 	FATFS *fs = dp->obj.fs;
+#if FF_FS_DCACHE
+	DWORD org;
+	const TCHAR *top;
+#endif
 
 
 #if FF_FS_RPATH != 0
@@ -3096,6 +4345,14 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		dp->obj.stat = fs->dirbuf[XDIR_GenFlags] & 2;
 	}
 #endif
+#endif
+#if FF_FS_DCACHE
+	org = dp->obj.sclust;
+	top = path;
+	if ((UINT)*path >= ' ') {				/* Skip the sub-directories in the cache */
+		res = find_dcache(dp, &path);
+		if (res != FR_OK) return res;
+	}
 #endif
 
 	if ((UINT)*path < ' ') {				/* Null path name is the origin directory itself */
@@ -3108,6 +4365,9 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 			if (res != FR_OK) break;
 			res = dir_find(dp);				/* Find an object with the segment name */
 			ns = dp->fn[NSFLAG];
+#if FF_FS_DCACHE
+			if (ns & NS_DOT) top = 0;		/* Do not cache the paths with a dot name */
+#endif
 			if (res != FR_OK) {				/* Failed to find the object */
 				if (res == FR_NO_FILE) {	/* Object is not found */
 					if (FF_FS_RPATH && (ns & NS_DOT)) {	/* If dot entry is not exist, stay there */
@@ -3136,6 +4396,9 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 			{
 				dp->obj.sclust = ld_clust(fs, fs->win + dp->dptr % SS(fs));	/* Open next directory */
 			}
+#if FF_FS_DCACHE
+			if (top) add_dcache(dp, org, top, path);	/* Cache the path to the sub-directory */
+#endif
 		}
 	}
 
@@ -3429,6 +4692,18 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* Following code attempts to mount the volume. (find a FAT volume, analyze the BPB and initialize the filesystem object) */
 
 	fs->fs_type = 0;					/* Clear the filesystem object */
+#if FF_FS_MEMFAT
+	free_memfat(fs);					/* Discard the in-memory FAT */
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+	free_fat2(fs);						/* Discard the pending FAT mirroring */
+#endif
+#if FF_FS_DIRIDX
+	free_index(fs);						/* Discard the directory indexes */
+#endif
+#if FF_FS_DCACHE
+	free_dcache(fs);					/* Discard the path cache */
+#endif
 	fs->pdrv = LD2PD(vol);				/* Volume hosting physical drive */
 	stat = disk_initialize(fs->pdrv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
@@ -3569,7 +4844,7 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		/* Get FSInfo if available */
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Initialize cluster allocation information */
 		fs->fsi_flag = 0x80;
-#if (FF_FS_NOFSINFO & 3) != 3
+#if (FF_FS_NOFSINFO & 3) != 3 || FF_FS_TRUSTFSINFO
 		if (fmt == FS_FAT32				/* Allow to update FSInfo only if BPB_FSInfo32 == 1 */
 			&& ld_word(fs->win + BPB_FSInfo32) == 1
 			&& move_window(fs, bsect + 1) == FR_OK)
@@ -3579,19 +4854,46 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 				&& ld_dword(fs->win + FSI_LeadSig) == 0x41615252
 				&& ld_dword(fs->win + FSI_StrucSig) == 0x61417272)
 			{
-#if (FF_FS_NOFSINFO & 1) == 0
+#if (FF_FS_NOFSINFO & 1) == 0 || FF_FS_TRUSTFSINFO
 				fs->free_clst = ld_dword(fs->win + FSI_Free_Count);
 #endif
-#if (FF_FS_NOFSINFO & 2) == 0
+#if (FF_FS_NOFSINFO & 2) == 0 || FF_FS_TRUSTFSINFO
 				fs->last_clst = ld_dword(fs->win + FSI_Nxt_Free);
+#endif
+#if FF_FS_TRUSTFSINFO
+				if (move_window(fs, fs->fatbase) != FR_OK || !(ld_dword(fs->win + 4) & CLN_SHUT)) {	/* Was the volume not cleanly unmounted? */
+					fs->fsi_flag = 0x40;	/* Leave the flag for the disk checker */
+#if FF_FS_NOFSINFO & 1
+					fs->free_clst = 0xFFFFFFFF;
+#endif
+#if FF_FS_NOFSINFO & 2
+					fs->last_clst = 0xFFFFFFFF;
+#endif
+				}
 #endif
 			}
 		}
-#endif	/* (FF_FS_NOFSINFO & 3) != 3 */
+#endif	/* (FF_FS_NOFSINFO & 3) != 3 || FF_FS_TRUSTFSINFO */
 #endif	/* !FF_FS_READONLY */
 	}
 
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type */
+#if FF_FS_MEMFAT
+	if (fs->memfat && load_memfat(fs) != FR_OK) {	/* Load the FAT into memory if requested and possible */
+		fs->fs_type = 0;
+		return FR_DISK_ERR;
+	}
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+#if FF_FS_MEMFAT
+	if (!fs->fatmem)		/* The in-memory FAT writes both FATs at sync by itself */
+#endif
+	init_fat2(fs);			/* Prepare deferred mirroring if possible */
+#endif
+#if FF_FS_DIRHINT && !FF_FS_READONLY
+	mem_set(fs->dhclst, 0xFF, sizeof fs->dhclst);	/* No free entry hint */
+	fs->dhnext = 0;
+#endif
 	fs->id = ++Fsid;		/* Volume mount ID */
 #if FF_USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
@@ -3662,7 +4964,7 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 FRESULT f_mount (
 	FATFS* fs,			/* Pointer to the filesystem object (NULL:unmount)*/
 	const TCHAR* path,	/* Logical drive number to be mounted/unmounted */
-	BYTE opt			/* Mode option 0:Do not mount (delayed mount), 1:Mount immediately */
+	BYTE opt			/* Mode option b0: 0:Do not mount (delayed mount), 1:Mount immediately, b1: Keep the FAT in memory */
 )
 {
 	FATFS *cfs;
@@ -3684,17 +4986,44 @@ FRESULT f_mount (
 		if (!ff_del_syncobj(cfs->sobj)) return FR_INT_ERR;
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
+#if FF_FS_MEMFAT
+		free_memfat(cfs);
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+		free_fat2(cfs);
+#endif
+#if FF_FS_DIRIDX
+		free_index(cfs);
+#endif
+#if FF_FS_DCACHE
+		free_dcache(cfs);
+#endif
 	}
 
 	if (fs) {
 		fs->fs_type = 0;				/* Clear new fs object */
+#if FF_FS_MEMFAT
+		fs->fatmem = 0;
+		fs->memfat = (opt & 2) ? 1 : 0;	/* Load the FAT into memory at mount if requested */
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+		fs->fat2buf = 0;
+#endif
+#if FF_FS_DIRIDX
+		mem_set(fs->dxtbl, 0, sizeof fs->dxtbl);
+		fs->dxnext = 0;
+#endif
+#if FF_FS_DCACHE
+		mem_set(fs->dcpath, 0, sizeof fs->dcpath);
+		fs->dcnext = 0;
+#endif
 #if FF_FS_REENTRANT						/* Create sync object for the new volume */
 		if (!ff_cre_syncobj((BYTE)vol, &fs->sobj)) return FR_INT_ERR;
 #endif
 	}
 	FatFs[vol] = fs;					/* Register new fs object */
 
-	if (opt == 0) return FR_OK;			/* Do not mount now, it will be mounted later */
+	if (!(opt & 1)) return FR_OK;		/* Do not mount now, it will be mounted later */
 
 	res = mount_volume(&path, &fs, 0);	/* Force mounted the volume */
 	LEAVE_FF(fs, res);
@@ -3850,6 +5179,9 @@ FRESULT f_open (
 			}
 #if FF_USE_FASTSEEK
 			fp->cltbl = 0;			/* Disable fast seek mode */
+#endif
+#if FF_USE_FASTSEEK == 2
+			fp->autotbl = 0;
 #endif
 			fp->obj.fs = fs;	 	/* Validate the file object */
 			fp->obj.id = fs->id;
@@ -3910,7 +5242,7 @@ FRESULT f_read (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst;
+	DWORD clst, ncl;
 	LBA_t sect;
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
@@ -3932,6 +5264,9 @@ FRESULT f_read (
 				if (fp->fptr == 0) {			/* On the top of the file? */
 					clst = fp->obj.sclust;		/* Follow cluster chain from the origin */
 				} else {						/* Middle or end of the file */
+#if FF_USE_FASTSEEK == 2
+					if (!fp->cltbl && (res = auto_clmt(fp)) != FR_OK) ABORT(fs, res);	/* Create CLMT at first cluster boundary */
+#endif
 #if FF_USE_FASTSEEK
 					if (fp->cltbl) {
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
@@ -3950,10 +5285,14 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
-				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+				if (csect + cc > fs->csize) {	/* Clip at the end of contiguous clusters */
+					ncl = (csect + cc - 1) / fs->csize;	/* Number of following clusters to be read */
+					res = follow_run(fp, &ncl);
+					if (res != FR_OK) ABORT(fs, res);
+					if (csect + cc > (ncl + 1) * fs->csize) cc = (UINT)(ncl + 1) * fs->csize - csect;
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				fp->clust += (csect + cc - 1) / fs->csize;	/* Move to the last cluster read */
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -4011,7 +5350,7 @@ FRESULT f_write (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD clst;
+	DWORD clst, rcl = 0, rnc = 0, bcs, ncl;
 	LBA_t sect;
 	UINT wcnt, cc, csect;
 	const BYTE *wbuff = (const BYTE*)buff;
@@ -4021,11 +5360,15 @@ FRESULT f_write (
 	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+	bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size */
 
 	/* Check fptr wrap-around (file size cannot reach 4 GiB at FAT volume) */
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
 		btw = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);
 	}
+#if FF_USE_FASTSEEK == 2
+	if (fp->fptr + btw > fp->obj.objsize) free_clmt(fp);	/* The file is to be expanded, discard the automatic CLMT */
+#endif
 
 	for ( ;  btw;							/* Repeat until all data written */
 		btw -= wcnt, *bw += wcnt, wbuff += wcnt, fp->fptr += wcnt, fp->obj.objsize = (fp->fptr > fp->obj.objsize) ? fp->fptr : fp->obj.objsize) {
@@ -4035,7 +5378,8 @@ FRESULT f_write (
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->obj.sclust;	/* Follow from the origin */
 					if (clst == 0) {		/* If no cluster is allocated, */
-						clst = create_chain(&fp->obj, 0);	/* create a new cluster chain */
+						rnc = btw / bcs + ((btw % bcs) ? 1 : 0);
+						clst = rcl = create_run(&fp->obj, 0, &rnc);	/* create a new cluster chain with a run for the data */
 					}
 				} else {					/* On the middle or end of the file */
 #if FF_USE_FASTSEEK
@@ -4043,8 +5387,11 @@ FRESULT f_write (
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					} else
 #endif
-					{
-						clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+					if (rnc > 1) {			/* In the run allocated by this call? */
+						clst = ++rcl; rnc--;
+					} else {
+						rnc = btw / bcs + ((btw % bcs) ? 1 : 0);
+						clst = rcl = create_run(&fp->obj, fp->clust, &rnc);	/* Follow or stretch cluster chain with a run for the rest of data */
 					}
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
@@ -4066,10 +5413,22 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fs);				/* When remaining bytes >= sector size, */
 			if (cc > 0) {					/* Write maximum contiguous sectors directly */
-				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+				if (csect + cc > fs->csize) {	/* Clip at the end of contiguous clusters */
+					ncl = (csect + cc - 1) / fs->csize;	/* Number of following clusters to be written */
+					if (rnc > 1) {				/* In the run allocated by this call? */
+						if (ncl > rnc - 1) ncl = rnc - 1;
+					} else {
+						res = follow_run(fp, &ncl);
+						if (res != FR_OK) ABORT(fs, res);
+					}
+					if (csect + cc > (ncl + 1) * fs->csize) cc = (UINT)(ncl + 1) * fs->csize - csect;
 				}
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				ncl = (csect + cc - 1) / fs->csize;	/* Move to the last cluster written */
+				fp->clust += ncl;
+				if (rnc > 1) {
+					rcl += ncl; rnc -= ncl;
+				}
 #if FF_FS_MINIMIZE <= 2
 #if FF_FS_TINY
 				if (fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
@@ -4219,6 +5578,9 @@ FRESULT f_close (
 	{
 		res = validate(&fp->obj, &fs);	/* Lock volume */
 		if (res == FR_OK) {
+#if FF_USE_FASTSEEK == 2
+			free_clmt(fp);				/* Discard the automatic CLMT */
+#endif
 #if FF_FS_LOCK != 0
 			res = dec_lock(fp->obj.lockid);		/* Decrement file open counter */
 			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
@@ -4431,7 +5793,6 @@ FRESULT f_lseek (
 	LBA_t nsect;
 	FSIZE_t ifptr;
 #if FF_USE_FASTSEEK
-	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
 	LBA_t dsc;
 #endif
 
@@ -4444,33 +5805,21 @@ FRESULT f_lseek (
 #endif
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
+#if FF_USE_FASTSEEK == 2
+	if (ofs != CREATE_LINKMAP && fp->cltbl == fp->autotbl) {	/* Not in fast seek mode by application? */
+		if (!FF_FS_READONLY && ofs > fp->obj.objsize && (fp->flag & FA_WRITE)) {
+			free_clmt(fp);	/* The file is to be expanded, discard the automatic CLMT */
+		} else {
+			res = auto_clmt(fp);	/* Create CLMT at first seek */
+			if (res != FR_OK) ABORT(fs, res);
+		}
+	}
+#endif
 #if FF_USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
-			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
-			cl = fp->obj.sclust;		/* Origin of the chain */
-			if (cl != 0) {
-				do {
-					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
-					do {
-						pcl = cl; ncl++;
-						cl = get_fat(&fp->obj, cl);
-						if (cl <= 1) ABORT(fs, FR_INT_ERR);
-						if (cl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-					} while (cl == pcl + 1);
-					if (ulen <= tlen) {		/* Store the length and top of the fragment */
-						*tbl++ = ncl; *tbl++ = tcl;
-					}
-				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
-			}
-			*fp->cltbl = ulen;	/* Number of items used */
-			if (ulen <= tlen) {
-				*tbl = 0;		/* Terminate table */
-			} else {
-				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
-			}
+			res = create_clmt(fp);
+			if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fs, res);
 		} else {						/* Fast seek */
 			if (ofs > fp->obj.objsize) ofs = fp->obj.objsize;	/* Clip offset at the file size */
 			fp->fptr = ofs;				/* Set file pointer */
@@ -4798,6 +6147,85 @@ FRESULT f_stat (
 
 
 #if !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Count zero entries in a block of FAT16/32                             */
+/*-----------------------------------------------------------------------*/
+/* The mask is given in memory byte order so that the same kernel checks
+/  the raw FAT sectors as well as the in-memory FAT. */
+
+static DWORD cnt_zero_c (	/* Number of zero entries */
+	const BYTE* p,		/* Block of entries */
+	UINT len,			/* Length of the block [byte] */
+	UINT esz,			/* Size of an entry (2 or 4) */
+	const BYTE* mask	/* Mask of an entry in memory byte order */
+)
+{
+	DWORD n = 0;
+	UINT i;
+
+
+	for (i = 0; i + esz <= len; i += esz) {
+		if (esz == 2) {
+			if ((p[i] | p[i + 1]) == 0) n++;
+		} else {
+			if (((p[i] & mask[0]) | (p[i + 1] & mask[1]) | (p[i + 2] & mask[2]) | (p[i + 3] & mask[3])) == 0) n++;
+		}
+	}
+	return n;
+}
+
+#if SIMD_X86
+__attribute__((target("sse2")))
+static DWORD cnt_zero_sse2 (const BYTE* p, UINT len, UINT esz, const BYTE* mask)
+{
+	__m128i m = _mm_set1_epi32((int)ld_dword(mask)), z = _mm_setzero_si128(), v;
+	DWORD n = 0;
+	UINT i;
+
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + i)), m);
+		v = (esz == 2) ? _mm_cmpeq_epi16(v, z) : _mm_cmpeq_epi32(v, z);
+		n += (DWORD)__builtin_popcount(_mm_movemask_epi8(v));	/* esz bits per zero entry */
+	}
+	return n / esz + cnt_zero_c(p + i, len - i, esz, mask);
+}
+
+__attribute__((target("avx2")))
+static DWORD cnt_zero_avx2 (const BYTE* p, UINT len, UINT esz, const BYTE* mask)
+{
+	__m256i m = _mm256_set1_epi32((int)ld_dword(mask)), z = _mm256_setzero_si256(), v;
+	DWORD n = 0;
+	UINT i;
+
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(p + i)), m);
+		v = (esz == 2) ? _mm256_cmpeq_epi16(v, z) : _mm256_cmpeq_epi32(v, z);
+		n += (DWORD)__builtin_popcount((unsigned)_mm256_movemask_epi8(v));
+	}
+	return n / esz + cnt_zero_c(p + i, len - i, esz, mask);
+}
+#endif
+
+static DWORD cnt_zero (const BYTE* p, UINT len, UINT esz, const BYTE* mask)
+{
+#if SIMD_X86
+	static BYTE simd;	/* 0:Not checked, 1:Portable, 2:SSE2, 3:AVX2 */
+
+	if (!simd) {	/* Select the kernel at first call */
+		__builtin_cpu_init();
+		simd = __builtin_cpu_supports("avx2") ? 3 : __builtin_cpu_supports("sse2") ? 2 : 1;
+	}
+	if (simd == 3) return cnt_zero_avx2(p, len, esz, mask);
+	if (simd == 2) return cnt_zero_sse2(p, len, esz, mask);
+#endif
+	return cnt_zero_c(p, len, esz, mask);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get Number of Free Clusters                                           */
 /*-----------------------------------------------------------------------*/
@@ -4837,48 +6265,75 @@ FRESULT f_getfree (
 			} else {
 #if FF_FS_EXFAT
 				if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan allocation bitmap */
-					BYTE bm;
-					UINT b;
+					QWORD bw;
 
 					clst = fs->n_fatent - 2;	/* Number of clusters */
 					sect = fs->bitbase;			/* Bitmap sector */
 					i = 0;						/* Offset in the sector */
-					do {	/* Counts numbuer of bits with zero in the bitmap */
+					do {	/* Counts numbuer of bits with zero in the bitmap, 64 bits at a time */
 						if (i == 0) {
 							res = move_window(fs, sect++);
 							if (res != FR_OK) break;
 						}
-						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
-							if (!(bm & 1)) nfree++;
-							bm >>= 1;
+						bw = ~ld_qword(fs->win + i);
+						if (clst < 64) {	/* Last word */
+							bw &= ((QWORD)1 << clst) - 1;
+							clst = 64;
 						}
-						i = (i + 1) % SS(fs);
+						nfree += pop_qword(bw);
+						clst -= 64;
+						i = (i + 8) % SS(fs);
 					} while (clst);
 				} else
 #endif
-				{	/* FAT16/32: Scan WORD/DWORD FAT entries */
-					clst = fs->n_fatent;	/* Number of entries */
+				{	/* FAT16/32: Count zero entries in the FAT */
+					static const BYTE mask16[] = {0xFF, 0xFF, 0xFF, 0xFF}, mask32[] = {0xFF, 0xFF, 0xFF, 0x0F};
+					UINT esz = (fs->fs_type == FS_FAT16) ? 2 : 4;
+					DWORD nb = fs->n_fatent * esz;	/* Size of entries to be checked [byte] */
+#if FF_USE_SIMD
+					BYTE buf[SZ_CNTBUF];	/* Read multiple sectors at a time to feed the kernel */
+#endif
+#if FF_FS_MEMFAT
+					DWORD mask = 0x0FFFFFFF;
+
+					if (fs->fatmem) {	/* In-memory FAT: Entries in host byte order, FAT16 entries are zero-extended */
+						nfree = cnt_zero((const BYTE*)fs->fatmem, (UINT)fs->n_fatent * 4, 4, (const BYTE*)&mask);
+						nb = 0;
+					}
+#endif
+#if FF_USE_SIMD
+					if (nb > 0) res = sync_window(fs);	/* Flush the window as it is bypassed */
+#endif
 					sect = fs->fatbase;		/* Top of the FAT */
-					i = 0;					/* Offset in the sector */
-					do {	/* Counts numbuer of entries with zero in the FAT */
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-						}
-						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
-							i += 2;
-						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
-							i += 4;
-						}
-						i %= SS(fs);
-					} while (--clst);
+					while (res == FR_OK && nb > 0) {
+#if FF_USE_SIMD
+						clst = SZ_CNTBUF / SS(fs);		/* Number of sectors to read */
+						if (clst > (nb + SS(fs) - 1) / SS(fs)) clst = (nb + SS(fs) - 1) / SS(fs);
+						if (disk_read(fs->pdrv, buf, sect, (UINT)clst) != RES_OK) res = FR_DISK_ERR;
+#else
+						clst = 1;
+						res = move_window(fs, sect);
+#endif
+						if (res != FR_OK) break;
+						i = (UINT)clst * SS(fs);	/* Size of entries in the block */
+						if (i > nb) i = (UINT)nb;
+#if FF_USE_SIMD
+						nfree += cnt_zero(buf, i, esz, (esz == 2) ? mask16 : mask32);
+#else
+						nfree += cnt_zero(fs->win, i, esz, (esz == 2) ? mask16 : mask32);
+#endif
+						nb -= i; sect += clst;
+					}
 				}
 			}
 			*nclst = nfree;			/* Return the free clusters */
 			fs->free_clst = nfree;	/* Now free_clst is valid */
 			fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+#if FF_FS_TRUSTFSINFO
+			if (res == FR_OK && fs->fs_type == FS_FAT32 && !(fs->fsi_flag & 0x40) && !(disk_status(fs->pdrv) & STA_PROTECT)) {	/* FAT32: Record it for the next mount unless the volume is left to the disk checker */
+				res = sync_fs(fs);
+			}
+#endif
 		}
 	}
 
@@ -4906,6 +6361,9 @@ FRESULT f_truncate (
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
 
 	if (fp->fptr < fp->obj.objsize) {	/* Process when fptr is not on the eof */
+#if FF_USE_FASTSEEK == 2
+		free_clmt(fp);	/* Discard the automatic CLMT as the chain is to be changed */
+#endif
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
 			res = remove_chain(&fp->obj, fp->obj.sclust, 0);
 			fp->obj.sclust = 0;
@@ -4952,6 +6410,9 @@ FRESULT f_unlink (
 	FATFS *fs;
 #if FF_FS_EXFAT
 	FFOBJID obj;
+#endif
+#if FF_FS_DIRHINT
+	DWORD *hint;
 #endif
 	DEF_NAMBUF
 
@@ -5013,11 +6474,21 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if FF_FS_DCACHE
+				if (res == FR_OK && (dj.obj.attr & AM_DIR)) free_dcache(fs);	/* Forget the paths through it */
+#endif
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
 #else
 					res = remove_chain(&dj.obj, dclst, 0);
+#endif
+#if FF_FS_DIRHINT
+					hint = dir_hint(fs, dclst, 0);
+					if (hint) *hint = 0;	/* The clusters can be reused for another directory */
+#endif
+#if FF_FS_DIRIDX
+					drop_index(fs, dclst);
 #endif
 				}
 				if (res == FR_OK) res = sync_fs(fs);
@@ -5206,6 +6677,9 @@ FRESULT f_rename (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&djo);		/* Remove old entry */
+#if FF_FS_DCACHE
+				if (res == FR_OK && (djo.obj.attr & AM_DIR)) free_dcache(fs);	/* Forget the paths through it */
+#endif
 				if (res == FR_OK) {
 					res = sync_fs(fs);
 				}
@@ -5877,7 +7351,21 @@ FRESULT f_mkfs (
 	/* Check mounted drive and clear work area */
 	vol = get_ldnumber(&path);					/* Get target logical drive */
 	if (vol < 0) return FR_INVALID_DRIVE;
-	if (FatFs[vol]) FatFs[vol]->fs_type = 0;	/* Clear the fs object if mounted */
+	if (FatFs[vol]) {							/* Clear the fs object if mounted */
+		FatFs[vol]->fs_type = 0;
+#if FF_FS_MEMFAT
+		free_memfat(FatFs[vol]);
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+		free_fat2(FatFs[vol]);
+#endif
+#if FF_FS_DIRIDX
+		free_index(FatFs[vol]);
+#endif
+#if FF_FS_DCACHE
+		free_dcache(FatFs[vol]);
+#endif
+	}
 	pdrv = LD2PD(vol);			/* Physical drive */
 	ipart = LD2PT(vol);			/* Partition (0:create as new, 1..:get from partition table) */
 	if (!opt) opt = &defopt;	/* Use default parameter if it is not given */
@@ -134,7 +134,7 @@ typedef struct {
 	BYTE	pdrv;			/* Associated physical drive */
 	BYTE	n_fats;			/* Number of FATs (1 or 2) */
 	BYTE	wflag;			/* win[] flag (b0:dirty) */
-	BYTE	fsi_flag;		/* FSINFO flags (b7:disabled, b0:dirty) */
+	BYTE	fsi_flag;		/* FSINFO flags (b7:disabled, b6:dirty at mount, b1:volume marked dirty, b0:dirty) */
 	WORD	id;				/* Volume mount ID */
 	WORD	n_rootdir;		/* Number of root directory entries (FAT12/16) */
 	WORD	csize;			/* Cluster size [sectors] */
@@ -170,6 +170,47 @@ typedef struct {
 	LBA_t	database;		/* Data base sector */
 #if FF_FS_EXFAT
 	LBA_t	bitbase;		/* Allocation bitmap base sector */
+#endif
+#if FF_FS_MEMFAT
+	BYTE	memfat;			/* Load the FAT into memory at mount (f_mount option) */
+	DWORD*	fatmem;			/* In-memory FAT in host byte order (NULL:not loaded) */
+	BYTE*	fatbuf;			/* Transfer buffer to load/flush the in-memory FAT */
+#if !FF_FS_READONLY
+	BYTE*	fatdirty;		/* Dirty flags of the FAT sectors (1 bit per sector) */
+	DWORD	fatdlo;			/* First dirty FAT sector */
+	DWORD	fatdhi;			/* Last dirty FAT sector + 1 */
+#endif
+#endif
+#if FF_FS_LAZYFAT && !FF_FS_READONLY
+	BYTE*	fat2buf;		/* Transfer buffer to copy the 1st FAT into the 2nd FAT (NULL:immediate mirroring) */
+	BYTE*	fat2dirty;		/* 1st FAT sectors not reflected to the 2nd FAT yet (1 bit per sector) */
+	DWORD	fat2lo;			/* First sector to be reflected */
+	DWORD	fat2hi;			/* Last sector to be reflected + 1 */
+#endif
+#if FF_FS_DIRHINT && !FF_FS_READONLY
+	DWORD	dhclst[FF_FS_DIRHINT];	/* Start cluster of the directories with a free entry hint (0xFFFFFFFF:unused) */
+	DWORD	dhofs[FF_FS_DIRHINT];	/* Offset of the first entry that can be free in each directory */
+#if FF_USE_LFN
+	BYTE	dhsfn[FF_FS_DIRHINT][11];	/* SFN that got a numbered name last in each directory */
+	BYTE	dhseq[FF_FS_DIRHINT];	/* Sequence number of the numbered name */
+#endif
+	BYTE	dhnext;			/* Hint slot to be reused next */
+#endif
+#if FF_FS_DIRIDX
+	DWORD	dxclst[FF_FS_DIRIDX];	/* Start cluster of the indexed directories */
+	DWORD*	dxtbl[FF_FS_DIRIDX];	/* Hashed name index of each directory (NULL:unused slot) */
+	BYTE	dxnext;			/* Index slot to be reused next */
+#endif
+#if FF_FS_DCACHE
+	DWORD	dcorg[FF_FS_DCACHE];	/* Origin directory of the cached paths */
+	DWORD	dcclst[FF_FS_DCACHE];	/* Start cluster of the sub-directory each path leads to */
+#if FF_FS_EXFAT
+	DWORD	dcc_scl[FF_FS_DCACHE];	/* Containing directory start cluster of the sub-directory */
+	DWORD	dcc_size[FF_FS_DCACHE];	/* b31-b8:Size of the containing directory, b7-b0: Chain status */
+	DWORD	dcc_ofs[FF_FS_DCACHE];	/* Offset of the sub-directory's entry in the containing directory */
+#endif
+	TCHAR*	dcpath[FF_FS_DCACHE];	/* Cached path prefix (NULL:unused slot) */
+	BYTE	dcnext;			/* Cache slot to be reused next */
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
@@ -216,6 +257,9 @@ typedef struct {
 #if FF_USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
 #endif
+#if FF_USE_FASTSEEK == 2
+	DWORD*	autotbl;		/* Automatically created cluster link map table (NULL:not created) */
+#endif
 #if !FF_FS_TINY
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
 #endif
@@ -362,7 +406,7 @@ WCHAR ff_oem2uni (WCHAR oem, WORD cp);	/* OEM code to Unicode conversion */
 WCHAR ff_uni2oem (DWORD uni, WORD cp);	/* Unicode to OEM code conversion */
 DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 #endif
-#if FF_USE_LFN == 3						/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_FS_MEMFAT || FF_USE_FASTSEEK == 2 || FF_FS_LAZYFAT || FF_FS_DIRIDX || FF_FS_DCACHE	/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);			/* Allocate memory block */
 void ff_memfree (void* mblock);			/* Free memory block */
 #endif
@@ -30,6 +30,10 @@
 #define MERGE2(a, b) a ## b
 #define CVTBL(tbl, cp) MERGE2(tbl, cp)
 
+#if FF_LFN_FASTCVT
+#define FCVT_LIM	0x3000	/* Code points below this are converted by direct-indexed tables */
+#endif
+
 
 /*------------------------------------------------------------------------*/
 /* Code Conversion Tables                                                 */
@@ -15228,11 +15232,29 @@ WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 	const WCHAR *p = CVTBL(uc, FF_CODE_PAGE);
 
 
+#if FF_LFN_FASTCVT
+	static BYTE u2o[FCVT_LIM - 0x80];	/* Unicode --> OEM direct-indexed table built at the first call */
+	static BYTE u2o_ok;
+#endif
+
+
 	if (uni < 0x80) {	/* ASCII? */
 		c = (WCHAR)uni;
 
 	} else {			/* Non-ASCII */
 		if (uni < 0x10000 && cp == FF_CODE_PAGE) {	/* Is it in BMP and valid code page? */
+#if FF_LFN_FASTCVT
+			if (uni < FCVT_LIM) {
+				if (!u2o_ok) {
+					for (c = 0x80; c > 0; ) {	/* The lowest OEM code wins on duplicated mapping */
+						c--;
+						if (p[c] >= 0x80 && p[c] < FCVT_LIM) u2o[p[c] - 0x80] = (BYTE)(c + 0x80);
+					}
+					u2o_ok = 1;
+				}
+				return u2o[uni - 0x80];
+			}
+#endif
 			for (c = 0; c < 0x80 && uni != p[c]; c++) ;
 			c = (c + 0x80) & 0xFF;
 		}
@@ -15461,7 +15483,11 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 /* Unicode up-case conversion                                             */
 /*------------------------------------------------------------------------*/
 
+#if FF_LFN_FASTCVT
+static DWORD cvt_upper (	/* Returns up-converted code point */
+#else
 DWORD ff_wtoupper (	/* Returns up-converted code point */
+#endif
 	DWORD uni		/* Unicode code point to be up-converted */
 )
 {
@@ -15590,4 +15616,29 @@ DWORD ff_wtoupper (	/* Returns up-converted code point */
 }
 
 
+#if FF_LFN_FASTCVT
+DWORD ff_wtoupper (	/* Returns up-converted code point */
+	DWORD uni		/* Unicode code point to be up-converted */
+)
+{
+	static WORD upc[FCVT_LIM];	/* Up conversion direct-indexed table built at the first call */
+	static BYTE upc_ok;
+	UINT i;
+
+
+	if (uni < 0x80) {	/* ASCII? */
+		return (uni >= 'a' && uni <= 'z') ? uni - 0x20 : uni;
+	}
+	if (uni < FCVT_LIM) {
+		if (!upc_ok) {
+			for (i = 0; i < FCVT_LIM; i++) upc[i] = (WORD)cvt_upper(i);
+			upc_ok = 1;
+		}
+		return upc[uni];
+	}
+	return cvt_upper(uni);
+}
+#endif
+
+
 #endif /* #if FF_USE_LFN */
@@ -42,11 +42,14 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
-/* This option switches fast seek function. (0:Disable or 1:Enable) */
+#define FF_USE_FASTSEEK	2
+/* This option switches fast seek function. (0:Disable, 1:Enable or 2:Enable with
+/  automatic CLMT) When set to 2, a CLMT is created on the heap by ff_memalloc() at
+/  first seek or first cluster boundary in f_read() on the file unless the application
+/  gives its own one. It is discarded when the file is expanded or truncated. */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -137,6 +140,16 @@
 /  on character encoding. When LFN is not enabled, these options have no effect. */
 
 
+#define FF_LFN_FASTCVT	1
+/* This option switches the code conversions in ffunicode.c to direct-indexed
+/  tables. (0:Disable or 1:Enable)
+/  When enabled, ff_wtoupper() converts ASCII characters in-line and the other
+/  characters below U+3000 with a table built from the compressed table at the
+/  first call (24K bytes), and ff_uni2oem() of the SBCS fixed code pages does
+/  the same with an inverse table (12K bytes). The DBCS conversions are not
+/  affected. When LFN is not enabled, this option has no effect. */
+
+
 #define FF_STRF_ENCODE	0
 /* When FF_LFN_UNICODE >= 1 with LFN enabled, string I/O functions, f_gets(),
 /  f_putc(), f_puts and f_printf() convert the character encoding in it.
@@ -191,7 +204,7 @@
 
 
 #define FF_MIN_SS		512
-#define FF_MAX_SS		512
+#define FF_MAX_SS		4096
 /* This set of options configures the range of sector size to be supported. (512,
 /  1024, 2048 or 4096) Always set both 512 for most systems, generic memory card and
 /  harddisk. But a larger value may be required for on-board flash memory and some
@@ -210,12 +223,27 @@
 /  f_fdisk function. 0x100000000 max. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM		0
+#define FF_USE_TRIM		1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
 
 
+#define FF_USE_DISKV	1
+/* This option switches the vectored disk functions disk_readv() and disk_writev().
+/  (0:Disable or 1:Enable) Each function transfers a list of segments in a single
+/  request, which allows the lower layer to merge or batch them. When enabled, the
+/  sync_window() function writes a FAT sector and its mirror in a single request. */
+
+
+#define FF_USE_SIMD		1
+/* This option switches SIMD kernels for the FAT scan in f_getfree() function.
+/  (0:Disable or 1:Enable) The kernels need GCC or Clang on x86 and use AVX2 or
+/  SSE2 depending on the processor at run time. Other targets use portable code.
+/  When enabled, the FAT16/32 scan reads 16K bytes at a time into a buffer on the
+/  stack. Otherwise it reads the FAT one sector at a time through the window. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -259,6 +287,66 @@
 /  bit1=1: Do not trust last allocated cluster number in the FSINFO.
 */
 
+#define FF_FS_TRUSTFSINFO	1
+/* This option switches trusted FSINFO on the FAT32 volume. (0:Disable or 1:Enable)
+/  When enabled, the free cluster count and the last allocated cluster number in
+/  the FSINFO are used regardless of FF_FS_NOFSINFO if the clean shutdown flag in
+/  FAT[1] is set. The flag is cleared on the first FAT change and set again after
+/  the FSINFO is updated at sync, and a full FAT scan by f_getfree() is recorded
+/  in the FSINFO at once. A volume found not cleanly unmounted at mount is never
+/  marked clean and the scan is not written to it, so that it is left as it was
+/  to the disk checker. */
+
+#define FF_FS_MEMFAT	1
+/* This option switches the in-memory FAT. (0:Disable or 1:Enable)
+/  When enabled and the volume is mounted by f_mount() with bit 1 of the option
+/  set, the entire FAT is loaded into a host-endian array allocated by
+/  ff_memalloc() at mount, FAT reads are served from the memory and modified FAT
+/  sectors are written back in bulk at sync. The array needs 4 bytes per FAT entry.
+/  Otherwise, or if the memory could not be allocated, the FAT is accessed through
+/  the window as usual. Loading pays off only when most of the FAT is used. */
+
+#define FF_FS_LAZYFAT	1
+/* This option selects how the 2nd FAT is updated on the FAT volume with two FATs.
+/
+/   0: Each FAT sector written into the 1st FAT is reflected to the 2nd FAT at the
+/      same time. This keeps both FATs consistent at any time (crash-safe mode).
+/   1: The FAT sectors written into the 1st FAT are recorded in a bitmap allocated
+/      by ff_memalloc(), and copied to the 2nd FAT in a merged pass at sync.
+/
+/  The in-memory FAT (FF_FS_MEMFAT) writes the modified FAT sectors at sync. In
+/  mode 0 each run is written into both FATs at once, and in mode 1 the 2nd FAT
+/  is written from the memory image after the whole 1st FAT, so that it holds
+/  the previous state until the 1st FAT is complete. The mode is fixed at build
+/  time. */
+
+
+#define FF_FS_DIRHINT	8
+/* This option sets the number of directories whose free entry hint is kept in
+/  the filesystem object. (0:Disable or 1-255)
+/  The hint is the offset of the first entry that can be free, so that creating
+/  objects in a directory does not rescan the entries in use from the top. It is
+/  moved back when an entry is removed from the directory. */
+
+
+#define FF_FS_DIRIDX	8
+/* This option sets the number of directories whose hashed name index is kept in
+/  the filesystem object. (0:Disable or 1-255)
+/  The index maps the case-folded LFN and the SFN of each object to its entries
+/  and is built by ff_memalloc() when a search has scanned the directory without
+/  finding the object. It is kept up to date by object creation and removal and
+/  discarded at unmount or when it grows over 4M slots, so that searching an
+/  object in a large directory does not scan it again. */
+
+
+#define FF_FS_DCACHE	16
+/* This option sets the number of path prefixes kept in the path resolution cache
+/  of the filesystem object. (0:Disable or 1-255)
+/  Each prefix of a path leading to a sub-directory is cached with the directory
+/  it leads to in a string allocated by ff_memalloc(), so that following a path
+/  continues from the deepest cached directory instead of the origin directory.
+/  The cache is discarded when a sub-directory is removed or renamed. */
+
 #define FF_FS_LOCK	0
 /* The option FF_FS_LOCK switches file lock function to control duplicated file open
 /  and illegal operation to open objects. This option must be 0 when FF_FS_READONLY